@@ -31,6 +31,15 @@ class aabb {
         return x;
      }
 
+     // Gives flat boxes (e.g. around an axis aligned triangle) a little thickness, as the
+     // slab test in hit never reports a hit on a box with zero size in some axis
+     void pad_to_minimums() {
+         const double delta = 0.0001;
+         if (x.size() < delta) x = x.expand(delta);
+         if (y.size() < delta) y = y.expand(delta);
+         if (z.size() < delta) z = z.expand(delta);
+     }
+
      int longest_axis() const {
          // Returns index of longest axis of bounding box
          if (x.size() > y.size()) {
@@ -40,6 +49,11 @@ class aabb {
          }
      }
 
+     double surface_area() const {
+         auto dx = x.size(), dy = y.size(), dz = z.size();
+         return 2 * (dx*dy + dy*dz + dz*dx);
+     }
+
      bool hit (const ray& r, interval ray_bounds) const
      {
       const point3& ray_orig = r.origin();
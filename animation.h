@@ -0,0 +1,267 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "rtweekend.h"
+
+#include "hittable_list.h"
+#include "material.h"
+#include "settings.h"
+#include "tlas.h"
+#include "transform.h"
+#include "triangle.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+/* Keyframed animation of triangle meshes and of the camera.
+   Unlike the linear motion of triangle::direction (which only covers the shutter interval
+   of one image) this moves geometry between the frames of a sequence. */
+
+// Pose of an object at a point in time (in seconds)
+struct keyframe {
+    double time = 0;
+    vec3 translate;
+    double rotate_y = 0; // Rotation around the y axis, in degrees
+    double scale = 1;
+    int mesh = -1; // The mesh it moves (by index in the scene), -1 for all without keyframes of their own
+
+    // Moves a point from the object's rest pose into this pose
+    point3 apply(const point3& p) const {
+        auto radians = degrees_to_radians(rotate_y);
+        auto cos_theta = cos(radians);
+        auto sin_theta = sin(radians);
+        point3 rotated(cos_theta*p.x() + sin_theta*p.z(), p.y(), -sin_theta*p.x() + cos_theta*p.z());
+        return scale * rotated + translate;
+    }
+
+    // The same as a transform, for moving an instance (see tlas.h) rather than its points
+    affine_transform transform() const {
+        return affine_transform::translate(translate) * affine_transform::rotate(vec3(0, 1, 0), rotate_y)
+             * affine_transform::scale(scale);
+    }
+};
+
+class keyframed_transform {
+    public:
+        std::vector<keyframe> keys; // In order of time (for each mesh)
+
+        /* The keyframes of one mesh: its own, or if it has none those for all meshes. A file
+           can hold several meshes' keyframes, which have to be split up with this before at()
+           is used. */
+        keyframed_transform track(int mesh) const {
+            keyframed_transform own, shared;
+            for (const auto& key : keys) {
+                if (key.mesh == mesh)
+                    own.keys.push_back(key);
+                else if (key.mesh == -1)
+                    shared.keys.push_back(key);
+            }
+            return own.keys.empty() ? shared : own;
+        }
+
+        // Highest mesh index with keyframes of its own (-1 if none)
+        int last_mesh() const {
+            int last = -1;
+            for (const auto& key : keys)
+                last = std::max(last, key.mesh);
+            return last;
+        }
+
+        // Linearly interpolates the keyframes (holding the first/last pose outside of them)
+        keyframe at(double time) const {
+            if (keys.empty()) return keyframe();
+            if (time <= keys.front().time) return keys.front();
+            if (time >= keys.back().time) return keys.back();
+
+            size_t k = 1;
+            while (keys[k].time < time)
+                k++;
+            const keyframe& a = keys[k-1];
+            const keyframe& b = keys[k];
+            auto t = (time - a.time) / (b.time - a.time);
+
+            keyframe pose;
+            pose.time = time;
+            pose.translate = (1-t)*a.translate + t*b.translate;
+            pose.rotate_y = (1-t)*a.rotate_y + t*b.rotate_y;
+            pose.scale = (1-t)*a.scale + t*b.scale;
+            return pose;
+        }
+
+        /* Reads keyframes from a file, one per line as settings (see settings.h):
+             time=<seconds> translate=x,y,z rotate_y=<degrees> scale=<factor> [mesh=<index>]
+           Keyframes with a mesh only move that mesh of the scene (meshes count from 0 in the
+           order the scene loads them), the rest move every mesh without any of its own.
+           Returns false on errors or if a mesh's keyframes are not in order of time. */
+        bool load(const std::string& path) {
+            std::ifstream file(path);
+            if (!file) {
+                std::cerr << "ERROR::ANIMATION:: Could not open keyframes " << path << std::endl;
+                return false;
+            }
+
+            std::string line;
+            for (int line_number = 1; std::getline(file, line); line_number++) {
+                auto first = line.find_first_not_of(" \t");
+                if (first == std::string::npos || line[first] == '#')
+                    continue;
+
+                keyframe key;
+                std::vector<setting> settings;
+                bool ok = parse_settings(line, settings);
+                for (auto& s : settings) {
+                    if (s.first == "time")          ok = ok && parse_double(s.second, key.time);
+                    else if (s.first == "translate") ok = ok && parse_vec3(s.second, key.translate);
+                    else if (s.first == "rotate_y")  ok = ok && parse_double(s.second, key.rotate_y);
+                    else if (s.first == "scale")     ok = ok && parse_double(s.second, key.scale);
+                    else if (s.first == "mesh")      ok = ok && parse_int(s.second, key.mesh) && key.mesh >= 0;
+                    else ok = false;
+                }
+                for (auto k = keys.rbegin(); k != keys.rend(); ++k) {
+                    if (k->mesh == key.mesh) {
+                        ok = ok && key.time > k->time;
+                        break;
+                    }
+                }
+
+                if (!ok) {
+                    std::cerr << "ERROR::ANIMATION:: Bad keyframe on line " << line_number << " of " << path << std::endl;
+                    return false;
+                }
+                keys.push_back(key);
+            }
+            return true;
+        }
+};
+
+// Where the camera is at a point in time (in seconds)
+struct camera_keyframe {
+    double time = 0;
+    point3 lookfrom;
+    point3 lookat;
+};
+
+/* Keyframed camera motion for fly-throughs, interpolated linearly like keyframed_transform.
+   Read from a file, one keyframe per line as settings (see settings.h):
+     time=<seconds> lookfrom=x,y,z lookat=x,y,z */
+class camera_path {
+    public:
+        std::vector<camera_keyframe> keys; // In order of time
+
+        camera_keyframe at(double time) const {
+            if (keys.empty()) return camera_keyframe();
+            if (time <= keys.front().time) return keys.front();
+            if (time >= keys.back().time) return keys.back();
+
+            size_t k = 1;
+            while (keys[k].time < time)
+                k++;
+            const camera_keyframe& a = keys[k-1];
+            const camera_keyframe& b = keys[k];
+            auto t = (time - a.time) / (b.time - a.time);
+
+            camera_keyframe pose;
+            pose.time = time;
+            pose.lookfrom = (1-t)*a.lookfrom + t*b.lookfrom;
+            pose.lookat = (1-t)*a.lookat + t*b.lookat;
+            return pose;
+        }
+
+        // Moves cam to its pose at time
+        void apply(camera& cam, double time) const {
+            auto pose = at(time);
+            cam.lookfrom = pose.lookfrom;
+            cam.lookat = pose.lookat;
+        }
+
+        // Returns false on errors, if a keyframe lacks lookfrom or lookat, or if they are not
+        // in order of time
+        bool load(const std::string& path) {
+            std::ifstream file(path);
+            if (!file) {
+                std::cerr << "ERROR::ANIMATION:: Could not open camera path " << path << std::endl;
+                return false;
+            }
+
+            std::string line;
+            for (int line_number = 1; std::getline(file, line); line_number++) {
+                auto first = line.find_first_not_of(" \t");
+                if (first == std::string::npos || line[first] == '#')
+                    continue;
+
+                camera_keyframe key;
+                std::vector<setting> settings;
+                bool ok = parse_settings(line, settings);
+                bool has_lookfrom = false, has_lookat = false;
+                for (auto& s : settings) {
+                    if (s.first == "time")          ok = ok && parse_double(s.second, key.time);
+                    else if (s.first == "lookfrom") ok = ok && (has_lookfrom = parse_vec3(s.second, key.lookfrom));
+                    else if (s.first == "lookat")   ok = ok && (has_lookat = parse_vec3(s.second, key.lookat));
+                    else ok = false;
+                }
+                if (!has_lookfrom || !has_lookat || (!keys.empty() && key.time <= keys.back().time))
+                    ok = false;
+
+                if (!ok) {
+                    std::cerr << "ERROR::ANIMATION:: Bad camera keyframe on line " << line_number << " of " << path << std::endl;
+                    return false;
+                }
+                keys.push_back(key);
+            }
+            return true;
+        }
+};
+
+/* A mesh moved by a keyframed transform, as an instance in a tlas (its BLAS made from the
+   triangles in their rest pose). Moving it only changes the instance's transform, so the
+   tlas needs an update() but the triangles and their BVH stay as they are.
+   The light tree and the photon map's caustic casters are made from triangles in the world
+   though, so the mesh's emissive and specular triangles are kept too, and moved copies of
+   them can be made for each frame (see sequence.h). */
+class animated_mesh {
+    public:
+        keyframed_transform motion;
+
+        // triangles is the mesh in its rest pose, the same as in the instance's BLAS
+        animated_mesh(size_t id, const keyframed_transform& motion, const hittable_list& triangles)
+         : motion(motion), id(id) {
+            for (const auto& object : triangles.objects) {
+                auto tri = std::dynamic_pointer_cast<triangle>(object);
+                auto mat = object->surface_material();
+                if (tri && mat && (mat->is_specular() || dynamic_cast<const diffuse_light*>(mat)))
+                    surfaces.push_back(tri);
+            }
+        }
+
+        /* Moves the mesh to its pose at time in scene. With shutter > 0 (in seconds) it moves
+           on from there over the shutter interval, to its pose at time + shutter. Returns
+           false if the mesh's instance is not in scene. */
+        bool set_time(tlas& scene, double time, double shutter = 0) const {
+            if (shutter > 0)
+                return scene.set_transform(id, motion.at(time).transform(), motion.at(time + shutter).transform());
+            return scene.set_transform(id, motion.at(time).transform());
+        }
+
+        // True if the mesh has emissive or specular triangles (see posed_surfaces)
+        bool has_surfaces() const { return !surfaces.empty(); }
+
+        // Adds copies of the emissive and specular triangles, in their pose at time, to out
+        void posed_surfaces(double time, hittable_list& out) const {
+            auto pose = motion.at(time);
+            for (const auto& tri : surfaces) {
+                auto copy = std::make_shared<triangle>(*tri);
+                copy->set_vertices(pose.apply(tri->vertex(0)), pose.apply(tri->vertex(1)), pose.apply(tri->vertex(2)));
+                out.add(copy);
+            }
+        }
+
+    private:
+        size_t id; // Of the mesh's instance in the tlas
+        std::vector<std::shared_ptr<triangle>> surfaces; // Emissive and specular, in the rest pose
+};
+
+#endif
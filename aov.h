@@ -0,0 +1,56 @@
+#ifndef AOV_H
+#define AOV_H
+
+#include "rtweekend.h"
+
+#include "colour.h"
+
+#include <cstdint>
+#include <string>
+
+/* Fast integrators for checking assets and for compositing: instead of path tracing, each
+   camera sample looks only at what it hits first (AOVs, arbitrary output variables), or at
+   how much of the hemisphere there is open (ambient occlusion). They cost one camera ray,
+   plus for ambient occlusion a few any-hit rays, so they are a small fraction of a path
+   traced render. */
+enum class integrator_type {
+    path, // Full path tracing (the beauty image)
+    ambient_occlusion, // Share of cosine weighted rays from the first hit that escape
+    normals, // Shading normal at the first hit, mapped from [-1, 1] to [0, 1]
+    depth, // Distance in front of the camera d, as d / (d + focus_dist)
+    primitive_id, // A colour per sphere or triangle
+    material_id // A colour per material
+};
+
+inline bool parse_integrator_type(const std::string& name, integrator_type& type) {
+    if (name == "path") type = integrator_type::path;
+    else if (name == "ao") type = integrator_type::ambient_occlusion;
+    else if (name == "normals") type = integrator_type::normals;
+    else if (name == "depth") type = integrator_type::depth;
+    else if (name == "primitive_id") type = integrator_type::primitive_id;
+    else if (name == "material_id") type = integrator_type::material_id;
+    else return false;
+    return true;
+}
+
+/* First hit data of a pixel's camera samples, written alongside the image (see
+   framebuffer.h). Summed over the samples that hit something; the id is the first one's. */
+struct aov_sample {
+    colour albedo = colour(0, 0, 0); // Reflectance of the surface hit
+    vec3 normal = vec3(0, 0, 0); // Shading normal, facing the camera
+    double depth = 0; // Distance in front of the camera
+    uint32_t samples = 0; // Samples taken (whether they hit or not)
+    uint32_t hits = 0; // Samples that hit something
+    uint32_t view_dependent = 0; // Samples whose first hit was glossy or specular
+    uint32_t object_id = 0; // Id of the first object hit (0 if none)
+};
+
+// A colour for an object or material id: the same id always gets the same colour, and
+// different ids almost always clearly different ones
+inline colour id_colour(uint64_t id) {
+    auto bits = mix_bits(id);
+    auto channel = [&](int shift) { return 0.1 + 0.9 * ((bits >> shift) & 0xff) / 255.0; };
+    return colour(channel(0), channel(8), channel(16));
+}
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "settings.h"
+#include "tile.h"
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/* Batch rendering: several cameras (e.g. turntable frames or viewpoints) rendered against
+   one scene and BVH. The tiles of every camera go into a single pool, so threads finishing
+   one view carry straight on with the next instead of waiting for the slowest tile.
+   Path guiding learns in passes over a whole image, which the shared pool does not have,
+   so batch cameras are never guided. */
+
+struct batch_camera {
+    camera cam;
+    std::string output; // Path the image is written to
+};
+
+// Renders every camera in the batch, leaving the results in images (one per camera)
+inline void render_batch(const hittable& world, std::vector<batch_camera>& batch,
+                         std::vector<framebuffer>& images, int thread_count) {
+    struct batch_tile {
+        size_t camera_index;
+        tile bounds;
+    };
+
+    std::vector<batch_tile> tiles;
+    images.resize(batch.size());
+    for (size_t c = 0; c < batch.size(); c++) {
+        // The cameras are copies of one, sharing the scene's photon map, so it is only
+        // built for the first
+        auto& cam = batch[c].cam;
+        for (auto& t : cam.prepare(world, images[c]))
+            tiles.push_back(batch_tile{c, t});
+    }
+
+    run_tile_jobs(tiles.size(), thread_count, [&](size_t t) {
+        auto c = tiles[t].camera_index;
+        const auto& cam = batch[c].cam;
+        cam.render_tile(world, images[c], tiles[t].bounds, 0, cam.samples_per_pixel);
+    });
+}
+
+/* Reads a camera list: one camera per line, given as settings (see settings.h) on top of
+   the defaults camera, plus out=<image.ppm>. Blank lines and lines starting with # are
+   skipped. Cameras without an out= are written to camera<n>.ppm. Returns false on errors. */
+inline bool load_camera_list(const std::string& path, const camera& defaults, std::vector<batch_camera>& batch) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "ERROR::BATCH:: Could not open camera list " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    for (int line_number = 1; std::getline(file, line); line_number++) {
+        auto first = line.find_first_not_of(" \t");
+        if (first == std::string::npos || line[first] == '#')
+            continue;
+
+        std::vector<setting> settings;
+        batch_camera entry{defaults, "camera" + std::to_string(batch.size()) + ".ppm"};
+        bool ok = parse_settings(line, settings);
+        for (auto& s : settings) {
+            if (s.first == "out")
+                entry.output = s.second;
+            else if (!apply_camera_setting(entry.cam, s.first, s.second))
+                ok = false;
+        }
+
+        if (!ok) {
+            std::cerr << "ERROR::BATCH:: Bad camera on line " << line_number << " of " << path << std::endl;
+            return false;
+        }
+        batch.push_back(entry);
+    }
+    return true;
+}
+
+#endif
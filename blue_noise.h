@@ -0,0 +1,115 @@
+#ifndef BLUE_NOISE_H
+#define BLUE_NOISE_H
+
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/* Tileable blue noise mask, made with the void and cluster method (Ulichney 1993).
+   Every texel holds a distinct rank, spread so that the texels below any threshold are
+   evenly spaced with no clumps or holes. Used as a per pixel offset, it pushes the error
+   of a low sample count render into high frequencies, which the eye (and a denoiser)
+   averages away much better than white noise. */
+class blue_noise_mask {
+    public:
+        static const int size = 64; // Width and height in texels (a power of two)
+
+        // The shared mask, generated the first time it is needed (takes a few tens of ms)
+        static const blue_noise_mask& get() {
+            static const blue_noise_mask mask;
+            return mask;
+        }
+
+        // Value in [0,1) at texel x, y. Wraps around, so the mask tiles the plane.
+        double value(int x, int y) const {
+            return values[wrap(y) * size + wrap(x)];
+        }
+
+    private:
+        static const int count = size * size;
+        std::vector<double> values;
+
+        blue_noise_mask() : values(count) {
+            // Gaussian energy of a point at each toroidal offset
+            const double sigma = 1.5;
+            std::vector<double> kernel(count);
+            for (int dy = 0; dy < size; dy++)
+                for (int dx = 0; dx < size; dx++) {
+                    auto x = std::min(dx, size - dx);
+                    auto y = std::min(dy, size - dy);
+                    kernel[dy * size + dx] = exp(-(x*x + y*y) / (2 * sigma * sigma));
+                }
+
+            std::vector<bool> on(count, false);
+            std::vector<double> energy(count, 0.0);
+            auto toggle = [&](int index, bool set) {
+                on[index] = set;
+                int px = index % size, py = index / size;
+                double sign = set ? 1 : -1;
+                for (int y = 0; y < size; y++)
+                    for (int x = 0; x < size; x++)
+                        energy[y * size + x] += sign * kernel[wrap(y - py) * size + wrap(x - px)];
+            };
+            // Tightest cluster: the set texel with most energy. Largest void: the empty one with least.
+            auto tightest_cluster = [&]() {
+                int best = -1;
+                for (int i = 0; i < count; i++)
+                    if (on[i] && (best < 0 || energy[i] > energy[best])) best = i;
+                return best;
+            };
+            auto largest_void = [&]() {
+                int best = -1;
+                for (int i = 0; i < count; i++)
+                    if (!on[i] && (best < 0 || energy[i] < energy[best])) best = i;
+                return best;
+            };
+
+            // Initial pattern: 10% random points, relaxed by moving clusters into voids
+            pcg32 rng(0x626c7565); // Fixed seed, so the mask is the same every run
+            int initial = count / 10;
+            for (int placed = 0; placed < initial;) {
+                int index = rng.next() % count;
+                if (!on[index]) {
+                    toggle(index, true);
+                    placed++;
+                }
+            }
+            while (true) {
+                int cluster = tightest_cluster();
+                toggle(cluster, false);
+                int hole = largest_void();
+                toggle(hole, true);
+                if (hole == cluster)
+                    break;
+            }
+            auto prototype = on;
+            auto prototype_energy = energy;
+
+            std::vector<int> rank(count);
+            // Ranks below the initial pattern: take points out of the tightest clusters
+            for (int r = initial - 1; r >= 0; r--) {
+                int cluster = tightest_cluster();
+                toggle(cluster, false);
+                rank[cluster] = r;
+            }
+            // Ranks above it: fill the largest voids
+            on = prototype;
+            energy = prototype_energy;
+            for (int r = initial; r < count; r++) {
+                int hole = largest_void();
+                toggle(hole, true);
+                rank[hole] = r;
+            }
+
+            for (int i = 0; i < count; i++)
+                values[i] = (rank[i] + 0.5) / count;
+        }
+
+        static int wrap(int v) {
+            return v & (size - 1); // size is a power of two
+        }
+};
+
+#endif
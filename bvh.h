@@ -4,6 +4,7 @@
 #include "aabb.h"
 #include "hittable.h"
 #include "hittable_list.h"
+#include "progress.h"
 
 #include <algorithm>
 
@@ -39,6 +40,7 @@ class bvh_node : public hittable {
         }
 
         bool hit(const ray&r, interval ray_bounds, hit_record& rec) const override {
+            count_bvh_node();
             if (!bbox.hit(r, ray_bounds))
                 return false;
             
@@ -48,14 +50,49 @@ class bvh_node : public hittable {
             // - The use of rec.t as an upper bound of the interval sent to right->hit means that any bbox hit
             //   further away than the previous hit will be discarded (at the !bbox.hit above)
             // - ray_bounds.min stays the same as the world bound
+            // - A node over a single object has it as both children, so it is only tested once
             bool hit_left = left->hit(r, ray_bounds, rec);
-            bool hit_right = right->hit(r, interval(ray_bounds.min, hit_left ? rec.t : ray_bounds.max), rec);
+            bool hit_right = right != left && right->hit(r, interval(ray_bounds.min, hit_left ? rec.t : ray_bounds.max), rec);
 
             return hit_left || hit_right;
         }
 
+        // Any hit: no need to find the nearest, so the first child with a hit ends the search
+        bool occluded(const ray& r, interval ray_bounds) const override {
+            count_bvh_node();
+            if (!bbox.hit(r, ray_bounds))
+                return false;
+            return left->occluded(r, ray_bounds) || (right != left && right->occluded(r, ray_bounds));
+        }
+
         aabb bounding_box() const override { return bbox; }
 
+        /* Recomputes the bounding boxes bottom up after objects have moved, keeping the tree
+           structure. Much cheaper than building a new tree, but the tree gets worse the further
+           objects move from where they were when it was built (see sah_cost). */
+        void refit() {
+            if (auto node = dynamic_cast<bvh_node*>(left.get()))
+                node->refit();
+            if (right != left) {
+                if (auto node = dynamic_cast<bvh_node*>(right.get()))
+                    node->refit();
+            }
+            bbox = aabb(left->bounding_box(), right->bounding_box());
+        }
+
+        /* Surface area heuristic cost of the tree. The chance of a random ray hitting a child box
+           is the ratio of its surface area to the parent's, so this is roughly the expected number
+           of boxes and objects tested per ray (counting 1 for each). Lower is better. */
+        double sah_cost() const {
+            auto area = bbox.surface_area();
+            auto child_cost = [&](const std::shared_ptr<hittable>& child) {
+                auto node = dynamic_cast<const bvh_node*>(child.get());
+                auto cost = node ? node->sah_cost() : 1.0;
+                return area > 0 ? cost * child->bounding_box().surface_area() / area : cost;
+            };
+            return 1.0 + child_cost(left) + (right != left ? child_cost(right) : 0.0);
+        }
+
         private:
             std::shared_ptr<hittable> left;
             std::shared_ptr<hittable> right;
@@ -3,11 +3,27 @@
 
 #include "rtweekend.h"
 
+#include "aov.h"
 #include "colour.h"
+#include "environment.h"
+#include "framebuffer.h"
+#include "guiding.h"
+#include "irradiance_cache.h"
 #include "hittable.h"
+#include "lights.h"
 #include "material.h"
-
+#include "photon_map.h"
+#include "pixel_filter.h"
+#include "progress.h"
+#include "sampler.h"
+#include "tile.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <thread>
 
 class camera {
   public:
@@ -25,38 +41,203 @@ class camera {
     //                           (Think of it like a cone) 
     double focus_dist = 10; // Distance from lookfrom point to plane (of perfect focus)
 
+    int threads = 0; // Number of render threads (0 uses one per hardware thread)
+    int tile_size = 32; // Width and height of the tiles handed out to render threads
+    const std::atomic<bool>* cancel = nullptr; // If set, rendering stops soon after it becomes true
+    bool show_progress = true; // Print progress, ETA and throughput to std::cerr while rendering
+    sampler_type sampler = sampler_type::independent; // Where sample dimensions come from (see sampler.h)
+
+    std::shared_ptr<const light_tree> lights; // The scene's emitters (set by the scene loader)
+    bool light_sampling = true; // Sample the lights directly at diffuse bounces (see lights.h)
+    bool sky = true; // Rays that miss everything see the sky gradient, otherwise the background
+    colour background = colour(0, 0, 0);
+    std::shared_ptr<const environment_map> environment; // If set, replaces the sky and background
+    bool guiding = false; // Learn where light comes from in passes and guide bounces there (see guiding.h)
+    std::shared_ptr<photon_map> caustics; // The scene's caustic casters (set by the scene loader)
+    size_t caustic_photons = 0; // If > 0, caustics come from a photon map of this many photons
+    bool irradiance_caching = false; // Interpolate light between diffuse surfaces (see irradiance_cache.h)
+    // Paths traced from each camera ray's first hit, by the material there (see split_sample)
+    int diffuse_splits = 1;
+    int glossy_splits = 1;
+    int specular_splits = 1;
+    integrator_type integrator = integrator_type::path; // What each sample computes (see aov.h)
+    int ao_rays = 16; // Occlusion rays per sample for ambient occlusion
+    double ao_distance = infinity; // Geometry further than this from a point doesn't occlude it
+    bool aovs = false; // Also fill the image's AOVs from every sample's first hit (see framebuffer.h)
+    pixel_filter filter; // How samples are weighted into pixels (see pixel_filter.h)
+
     void render(const hittable& world) {
+        framebuffer image;
+        render(world, image, 0, samples_per_pixel);
+        image.write_ppm(std::cout);
+    }
+
+    /* Accumulates samples [sample_begin, sample_end) of every pixel into image.
+       Every sample reseeds the random generator from its pixel and sample index, so renders
+       of separate sample ranges can be merged into exactly the image a full render gives.
+       The image is split into tiles which are handed out to the render threads as they
+       become free. Returns false if the render was cancelled before it finished. */
+    bool render(const hittable& world, framebuffer& image, int sample_begin, int sample_end) {
+        auto tiles = prepare(world, image);
+        if (integrator == integrator_type::path && guiding)
+            return render_guided(world, image, tiles, sample_begin, sample_end);
+
+        run_tile_jobs(tiles.size(), thread_count(), [&](size_t t) {
+            render_tile(world, image, tiles[t], sample_begin, sample_end);
+        }, cancel, show_progress);
+
+        return !cancelled();
+    }
+
+    /* Path guided render: the samples are taken in passes of 1, 2, 4... per pixel, the last
+       pass taking whatever is left, and the guide learns from every pass but the last.
+       Every pass goes into image, the early ones just have less help from the guide.
+       The guide starts from nothing on every call, so it only learns from sample_begin to
+       sample_end (and guided renders of split sample ranges differ slightly from one). */
+    bool render_guided(const hittable& world, framebuffer& image, const std::vector<tile>& tiles,
+                       int sample_begin, int sample_end) {
+        guide = std::make_shared<path_guide>(world.bounding_box());
+        // Boxes split past c sqrt(pass samples) records. Müller et al. use c = 12000 at
+        // 1280x720; 4 times that (fewer, better trained boxes) did better here. Records
+        // scale with the pixel count, so c does too.
+        auto split_scale = 48000.0 * image_width * image_height / (1280 * 720);
+
+        int pass_samples = 1;
+        for (int begin = sample_begin; begin < sample_end; pass_samples *= 2) {
+            auto end = begin + pass_samples;
+            if (sample_end - begin < 3 * pass_samples) // Not enough left for a bigger pass after this one
+                end = sample_end;
+            guide->recording = end < sample_end;
+
+            run_tile_jobs(tiles.size(), thread_count(), [&](size_t t) {
+                render_tile(world, image, tiles[t], begin, end);
+            }, cancel, show_progress);
+            if (cancelled())
+                return false;
+
+            if (guide->recording)
+                guide->refine(split_scale * sqrt(double(end - begin)));
+            begin = end;
+        }
+        guide.reset();
+        return true;
+    }
+
+    /* Sets up a render of image: the viewport, the image size and AOVs, and what the path
+       tracing extras need before the first sample. Returns the image's tiles. render does
+       this itself; callers driving render_tile directly (batch.h) must call it first.
+       The photon map only depends on the scene, so it is built by the first render that
+       needs it and kept (copies of the camera share it). Whoever changes the scene's
+       lights or caustic casters swaps in a new photon_map, which is built on the next
+       render. Path guiding learns in passes inside render and is not set up here. */
+    std::vector<tile> prepare(const hittable& world, framebuffer& image) {
         initialize();
 
-        std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+        if (image.width != image_width || image.height != image_height)
+            image = framebuffer(image_width, image_height);
+        if (aovs && !image.has_aovs())
+            image.enable_aovs();
+        if (filter.splats())
+            image.enable_weights();
+
+        // The photon map, irradiance cache and guide only matter to path tracing
+        build_photon_map(world);
+        bool path_tracing = integrator == integrator_type::path;
+        irradiance = path_tracing && irradiance_caching ? std::make_shared<irradiance_cache>(world.bounding_box()) : nullptr;
 
-        for (int j = 0; j < image_height; ++j) {
+        return make_tiles(image_width, image_height, tile_size);
+    }
 
-            std::cerr << "\rScanlines remaining: " << image_height - j << ' ' << std::flush;
+    // Builds the photon map if this camera needs one and it is not built yet. prepare does
+    // this itself; it is only worth calling ahead of time (see interactive.h).
+    void build_photon_map(const hittable& world) {
+        if (integrator == integrator_type::path && caustic_photons > 0 && caustics && !caustics->built())
+            caustics->build(world, lights.get(), environment.get(),
+                            [this](const vec3& direction) { return miss_colour(ray(point3(0, 0, 0), direction)); },
+                            caustic_photons, max_depth, thread_count());
+    }
 
-            for (int i = 0; i < image_width; ++i) {
-                colour pixel_colour(0, 0, 0);
-                for (int sample = 0; sample < samples_per_pixel; ++sample) {
-                    ray r = get_ray(i, j);
-                    pixel_colour += ray_colour(r, max_depth, world);
+    /* Renders samples [sample_begin, sample_end) of the pixels in tile t into image, or with
+       counts, samples [sample_begin, sample_begin + counts[pixel index]).
+       With a splatting filter the samples go into a splat tile of this thread's own, added
+       to the image once the tile is done, so the threads never write the same pixels. */
+    void render_tile(const hittable& world, framebuffer& image, const tile& t, int sample_begin, int sample_end,
+                     const std::vector<uint32_t>* counts = nullptr) const {
+        std::unique_ptr<splat_tile> splats;
+        if (filter.splats())
+            splats = std::make_unique<splat_tile>(t, filter.apron());
+
+        for (int j = t.y0; j < t.y1 && !cancelled(); ++j) {
+            for (int i = t.x0; i < t.x1; ++i) {
+                auto end = counts ? sample_begin + static_cast<int>((*counts)[j*image_width + i]) : sample_end;
+                if (end <= sample_begin)
+                    continue;
+                aov_sample aov;
+                auto aov_out = image.has_aovs() ? &aov : nullptr;
+                auto pixel_colour = render_pixel(world, i, j, sample_begin, end, aov_out, splats.get());
+                if (splats)
+                    image.add_samples(i, j, end - sample_begin);
+                else
+                    image.add(i, j, pixel_colour, end - sample_begin);
+                if (aov_out) {
+                    aov.samples = end - sample_begin;
+                    image.add_aovs(i, j, aov);
                 }
-                write_colour(std::cout, pixel_colour, samples_per_pixel);
             }
         }
-        std::cerr << "\nDone.\n";
+        if (splats)
+            image.add_splats(*splats);
     }
 
-  private:
-    int image_height; // Rendered image height
-    point3 centre; // Camera centre
-    point3 pixel00_loc; // Localtion of pixel 0,0
-    vec3 pixel_delta_u; // Offset to pixel to the right
-    vec3 pixel_delta_v; // Offset to pixel below
-    vec3 u, v, w; // Camera basis vectors (orthonormal)
-    vec3 defocus_disk_u; // Defocus disk horizontal radius
-    vec3 defocus_disk_v; // Defocus disk vertical radius
+    // Returns the sum (not the average) of samples [sample_begin, sample_end) of pixel i, j,
+    // adding their first hits to aov if given. With splats, the samples are splatted there
+    // through the filter instead (and the sum is 0).
+    colour render_pixel(const hittable& world, int i, int j, int sample_begin, int sample_end,
+                        aov_sample* aov = nullptr, splat_tile* splats = nullptr) const {
+        colour pixel_colour(0, 0, 0);
+        thread_counters().samples += sample_end - sample_begin;
+        begin_pixel(sampler, i, j, image_width, samples_per_pixel);
+        for (int sample = sample_begin; sample < sample_end; ++sample) {
+            begin_pixel_sample(j*image_width + i, sample);
+            vec2 offset;
+            ray r = get_ray(i, j, &offset);
+            auto c = sample_colour(r, world, aov);
+            if (splats)
+                splats->add(i + offset[0], j + offset[1], c, filter);
+            else
+                pixel_colour += c;
+        }
+        return pixel_colour;
+    }
 
+    // Colour of the camera sample r, from the chosen integrator
+    colour sample_colour(const ray& r, const hittable& world, aov_sample* aov = nullptr) const {
+        if (integrator != integrator_type::path)
+            return aov_colour(r, world, aov);
+        // split_sample keeps the first hit (which the AOVs need) apart from the rest of the path
+        if (primary_splitting() || aov)
+            return split_sample(r, world, aov);
+        return ray_colour(r, max_depth, world, true);
+    }
+
+    // True if any first hit splits into more than one path
+    bool primary_splitting() const {
+        return diffuse_splits > 1 || glossy_splits > 1 || specular_splits > 1;
+    }
+
+    bool cancelled() const {
+        return cancel && cancel->load(std::memory_order_relaxed);
+    }
+
+    // Number of threads render will use
+    int thread_count() const {
+        if (threads > 0)
+            return threads;
+        auto hardware_threads = static_cast<int>(std::thread::hardware_concurrency());
+        return hardware_threads > 0 ? hardware_threads : 1;
+    }
 
+    // Sets up the image size and viewport from the public settings. Called by render.
     void initialize() {
         image_height = static_cast<int>(image_width / aspect_ratio);
         image_height = (image_height < 1) ? 1 : image_height; // Ensure height is at least 1
@@ -100,8 +281,53 @@ class camera {
         defocus_disk_v = v * defocus_radius;
     }
 
+    // Rendered image height (only valid after initialize)
+    int height() const { return image_height; }
 
-    colour ray_colour(const ray& r, int depth, const hittable& world) const
+    // Point at view depth (distance along the view axis) on the ray through the centre of
+    // pixel i, j (only valid after initialize, like project)
+    point3 pixel_point(double i, double j, double depth) const {
+        auto direction = pixel00_loc + i*pixel_delta_u + j*pixel_delta_v - centre;
+        return centre + direction * (depth / focus_dist);
+    }
+
+    // The reverse of pixel_point: the pixel coordinates i, j and view depth of p. Returns
+    // false if p is not in front of the camera.
+    bool project(const point3& p, double& i, double& j, double& depth) const {
+        auto offset = p - centre;
+        depth = dot(offset, -w);
+        if (depth <= 0)
+            return false;
+        // Where the line to p crosses the viewport (focus_dist in front of the camera)
+        auto on_viewport = centre + offset * (focus_dist / depth) - pixel00_loc;
+        i = dot(on_viewport, pixel_delta_u) / pixel_delta_u.length_squared();
+        j = dot(on_viewport, pixel_delta_v) / pixel_delta_v.length_squared();
+        return true;
+    }
+
+  private:
+    int image_height; // Rendered image height
+    point3 centre; // Camera centre
+    point3 pixel00_loc; // Localtion of pixel 0,0
+    vec3 pixel_delta_u; // Offset to pixel to the right
+    vec3 pixel_delta_v; // Offset to pixel below
+    vec3 u, v, w; // Camera basis vectors (orthonormal)
+    vec3 defocus_disk_u; // Defocus disk horizontal radius
+    vec3 defocus_disk_v; // Defocus disk vertical radius
+    std::shared_ptr<path_guide> guide; // During a guided render
+    std::shared_ptr<irradiance_cache> irradiance; // During a render with irradiance caching
+    static constexpr double guide_fraction = 0.5; // Share of guided bounces that follow the guide
+
+    /* Light arriving along r. count_emission is false after a diffuse bounce whose direct
+       light was already sampled, so emitters hit by chance are not counted twice.
+       scatter_pdf is the pdf with which a diffuse bounce picked r (0 for camera rays and
+       specular bounces), for weighting the environment against environment sampling.
+       diffuse_bounces counts the diffuse bounces so far. With photon map caustics, the
+       first diffuse hit takes its caustics from the map, so light its path then reaches only
+       through specular bounces is not counted again. Later hits are blurrier in the image
+       and path trace their caustics as usual, which saves most of the photon lookups. */
+    colour ray_colour(const ray& r, int depth, const hittable& world, bool count_emission,
+                      double scatter_pdf = 0, int diffuse_bounces = 0) const
     {
         hit_record rec;
         
@@ -110,53 +336,381 @@ class camera {
             return colour(0.0, 0.0, 0.0);
 
         // world is a hittable list of all objects
-        if (world.hit(r, interval(0.001, infinity), rec)) {
+        thread_counters().rays++;
+        if (world.hit(r, interval(0.001, infinity), rec))
             // Note: 0.001 to infinity is used to avoid floating point errors giving hit coordinates within
             // the object. This leads to "shadow acne" - darker spots that occur due to rays hitting an object
             // multiple times from within the surface.
-            
-            ray scattered;
-            colour attenuation;
-            if (rec.mat->scatter(r, rec, attenuation, scattered))
-                return attenuation * ray_colour(scattered, depth-1, world);
-            
-            // If ray is absorbed, return no colour
+            return shade(r, rec, depth, world, count_emission, diffuse_bounces);
+
+        if (diffuse_bounces == 1 && scatter_pdf == 0 && photon_caustics())
+            return colour(0, 0, 0); // A caustic from the environment (the photon map has it)
+
+        auto escaped = miss_colour(r);
+        // A diffuse bounce that escaped shares the environment with environment_light (MIS)
+        if (scatter_pdf > 0 && sample_environment())
+            escaped *= power_heuristic(scatter_pdf, environment->pdf(r.direction()));
+        return escaped;
+    }
+
+    /* Primary hit splitting: the camera ray r is traced once, and its first hit is shaded
+       (lights sampled, bounce path traced) by as many separate paths as the material's
+       split count, returning their average as the sample's colour. Without defocus blur
+       the camera rays of a pixel all hit about the same point anyway, so the extra paths
+       cost no camera ray or first hit traversal, which is most of a path's cost in big
+       mesh scenes. Splitting more on glossy and glass surfaces, where the paths differ
+       most, spends the samples where the noise is. */
+    colour split_sample(const ray& r, const hittable& world, aov_sample* aov = nullptr) const {
+        hit_record rec;
+        if (max_depth <= 0)
             return colour(0, 0, 0);
+        thread_counters().rays++;
+        if (!world.hit(r, interval(0.001, infinity), rec))
+            return miss_colour(r);
+        if (aov)
+            record_aov(r, rec, *aov);
+
+        int splits = split_count(rec.mat->kind());
+        colour sum(0, 0, 0);
+        for (int split = 0; split < splits; split++) {
+            if (split > 0)
+                begin_split(split);
+            sum += shade(r, rec, max_depth, world, true, 0);
+        }
+        return sum / splits;
+    }
+
+    int split_count(material_class kind) const {
+        switch (kind) {
+            case material_class::diffuse: return std::max(diffuse_splits, 1);
+            case material_class::glossy: return std::max(glossy_splits, 1);
+            case material_class::specular: return std::max(specular_splits, 1);
+            default: return 1; // Nothing to split at a light
+        }
+    }
+
+    /* The fast integrators (see aov.h): a camera ray's first hit, and for ambient occlusion
+       any-hit rays from there. Rays that miss count as far away and unoccluded. */
+    colour aov_colour(const ray& r, const hittable& world, aov_sample* aov = nullptr) const {
+        hit_record rec;
+        thread_counters().rays++;
+        if (!world.hit(r, interval(0.001, infinity), rec)) {
+            bool far_open = integrator == integrator_type::ambient_occlusion || integrator == integrator_type::depth;
+            return far_open ? colour(1, 1, 1) : colour(0, 0, 0);
+        }
+        if (aov)
+            record_aov(r, rec, *aov);
+
+        switch (integrator) {
+            case integrator_type::ambient_occlusion:
+                return ambient_occlusion(r, rec, world) * colour(1, 1, 1);
+            case integrator_type::normals:
+                return 0.5 * (rec.normal + vec3(1, 1, 1));
+            case integrator_type::depth: {
+                auto depth = view_depth(r, rec);
+                return depth / (depth + focus_dist) * colour(1, 1, 1);
+            }
+            case integrator_type::primitive_id:
+                return id_colour(object_id(rec));
+            case integrator_type::material_id:
+                return id_colour(rec.mat->id);
+            default:
+                return colour(0, 0, 0);
+        }
+    }
+
+    // Adds the first hit rec of camera ray r to the pixel's AOVs
+    void record_aov(const ray& r, const hit_record& rec, aov_sample& aov) const {
+        if (aov.hits == 0)
+            aov.object_id = object_id(rec);
+        aov.albedo += rec.mat->surface_albedo(rec);
+        aov.normal += rec.normal;
+        aov.depth += view_depth(r, rec);
+        aov.hits++;
+        auto kind = rec.mat->kind();
+        if (kind == material_class::glossy || kind == material_class::specular)
+            aov.view_dependent++;
+    }
+
+    // Distance of the hit rec of camera ray r in front of the camera (along the view axis)
+    double view_depth(const ray& r, const hit_record& rec) const {
+        return rec.t * dot(r.direction(), -w);
+    }
+
+    /* Id of the primitive hit, from its bounding box rather than its address, so that the
+       same object gets the same id in every run and every render process. A primitive of a
+       shared mesh has the same box in every copy, so the box of the copy (instance) it was
+       hit through goes in too. Never 0 (no object). */
+    static uint32_t object_id(const hit_record& rec) {
+        if (!rec.object)
+            return 0;
+        uint64_t h = 0;
+        auto add_box = [&h](const aabb& box) {
+            for (int axis = 0; axis < 3; axis++) {
+                for (double bound : {box.axis_interval(axis).min, box.axis_interval(axis).max}) {
+                    uint64_t bits;
+                    std::memcpy(&bits, &bound, sizeof bits);
+                    h = mix_bits(h ^ bits);
+                }
+            }
+        };
+        add_box(rec.object->bounding_box());
+        if (rec.instance)
+            add_box(rec.instance->bounding_box());
+        return static_cast<uint32_t>(h) | 1;
+    }
+
+    // Share of ao_rays cosine weighted rays from the hit rec that get ao_distance away
+    double ambient_occlusion(const ray& r_in, const hit_record& rec, const hittable& world) const {
+        begin_bounce(0);
+        onb uvw(rec.normal);
+        int open = 0;
+        for (int k = 0; k < ao_rays; k++) {
+            ray probe(rec.p, uvw.local(sample_cosine_hemisphere()), r_in.time());
+            thread_counters().rays++;
+            if (!world.occluded(probe, interval(0.001, ao_distance)))
+                open++;
+        }
+        return ao_rays > 0 ? double(open) / ao_rays : 1;
+    }
+
+    // Light leaving the hit rec of r back along r (the hit part of ray_colour)
+    colour shade(const ray& r, const hit_record& rec, int depth, const hittable& world, bool count_emission,
+                 int diffuse_bounces) const {
+        int bounce = max_depth - depth;
+        begin_bounce(bounce);
+
+        colour emitted = count_emission ? rec.mat->emitted(r, rec) : colour(0, 0, 0);
+
+        scatter_record srec;
+        if (!rec.mat->scatter(r, rec, srec))
+            return emitted; // If ray is absorbed, return no more colour
 
+        if (srec.specular) {
+            bool caustic = diffuse_bounces == 1 && photon_caustics();
+            return emitted + srec.attenuation * ray_colour(srec.scattered, depth-1, world, !caustic, 0, diffuse_bounces);
         }
-    
+
+        directional_tree* guide_tree = guide ? &guide->at(rec.p) : nullptr;
+        if (guide_tree) {
+            begin_bounce(bounce, guiding_dimension_offset);
+            guided_scatter(r, rec, *guide_tree, srec);
+        }
+
+        bool sample_lights = light_sampling && lights && !lights->empty();
+        if (sample_lights) {
+            begin_bounce(bounce, light_dimension_offset);
+            emitted += direct_light(r, rec, world);
+        }
+        if (sample_environment()) {
+            begin_bounce(bounce, environment_dimension_offset);
+            emitted += environment_light(r, rec, world, guide_tree);
+        }
+        if (diffuse_bounces == 0 && photon_caustics())
+            emitted += caustics->estimate(r, rec);
+        // The light bounced here off other surfaces comes from the irradiance cache
+        if (diffuse_bounces == 0 && irradiance)
+            return emitted + rec.mat->eval(r, rec, rec.normal) * cached_irradiance(r, rec, depth, world);
+
+        // A guided direction can point into the surface (the guide covers the whole sphere)
+        if (srec.pdf <= 0 || srec.bsdf.near_zero())
+            return emitted;
+
+        // Monte Carlo estimate of the scattered light: bsdf * cos(theta) / pdf
+        auto cos_theta = fabs(dot(unit_vector(srec.scattered.direction()), rec.normal));
+        auto weight = srec.bsdf * (cos_theta / srec.pdf);
+        auto incoming = ray_colour(srec.scattered, depth-1, world, !sample_lights, srec.pdf,
+                                   std::min(diffuse_bounces + 1, 2));
+        // The guide learns light times cos(theta), so it leans towards the normal like
+        // the cosine term does (exactly so over flat surfaces, where a box has one normal)
+        if (guide_tree && guide->recording)
+            guide_tree->record(srec.scattered.direction(), luminance(incoming) * cos_theta / srec.pdf);
+        return emitted + weight * incoming;
+    }
+
+    // What rays that hit nothing see
+    colour miss_colour(const ray& r) const {
+        if (environment)
+            return environment->lookup(r.direction());
+
+        if (!sky)
+            return background;
+
         // Sky
         vec3 unit_direction = unit_vector(r.direction());
         auto a = 0.5*(unit_direction.y() + 1.0);
         return (1.0-a)*colour(1.0, 1.0, 1.0) + a*colour(0.5, 0.7, 1.0);
     }
 
-    ray get_ray(int i, int j) const {
+    /* Path guiding: takes the bounce direction from the guide instead of the bsdf for
+       guide_fraction of the bounces (once the guide has learned something here), and sets
+       the pdf to that of the mix of the two, so either choice is weighted correctly. */
+    void guided_scatter(const ray& r_in, const hit_record& rec, const directional_tree& tree,
+                        scatter_record& srec) const {
+        if (!tree.trained())
+            return;
+        double guide_pdf;
+        if (sample_1d() < guide_fraction) {
+            auto direction = tree.sample(sample_2d(), guide_pdf);
+            srec.scattered = ray(rec.p, direction, r_in.time());
+            srec.bsdf = rec.mat->eval(r_in, rec, direction);
+            srec.pdf = rec.mat->pdf(r_in, rec, direction);
+        } else {
+            guide_pdf = tree.pdf(srec.scattered.direction());
+        }
+        srec.pdf = (1 - guide_fraction) * srec.pdf + guide_fraction * guide_pdf;
+    }
+
+    // Pdf with which a diffuse bounce picks direction, with the guide tree if there is one
+    double bounce_pdf(const ray& r_in, const hit_record& rec, const directional_tree* tree,
+                      const vec3& direction) const {
+        auto pdf = rec.mat->pdf(r_in, rec, direction);
+        if (tree && tree->trained())
+            pdf = (1 - guide_fraction) * pdf + guide_fraction * tree->pdf(direction);
+        return pdf;
+    }
+
+    static double luminance(const colour& c) {
+        return 0.2126*c.x() + 0.7152*c.y() + 0.0722*c.z();
+    }
+
+    /* Irradiance at the (diffuse) hit rec from everything but direct light, interpolated
+       from the cache, or from a new record at rec if there is none near enough. */
+    colour cached_irradiance(const ray& r_in, const hit_record& rec, int depth, const hittable& world) const {
+        colour e;
+        if (irradiance->lookup(rec.p, rec.normal, e))
+            return e;
+
+        // The record's rays take independent random numbers: the sampler's dimensions belong
+        // to the pixel's path, and would give every one of them the same numbers
+        auto& state = thread_sampler();
+        auto type = state.type;
+        state.type = sampler_type::independent;
+
+        bool sample_lights = light_sampling && lights && !lights->empty();
+        auto pixel_size = pixel_delta_u.length() * (rec.p - centre).length() / focus_dist;
+        e = irradiance->create(rec.p, rec.normal, pixel_size, [&](const vec3& direction, double& distance) {
+            ray bounce(rec.p, direction, r_in.time());
+            hit_record nearest;
+            distance = world.hit(bounce, interval(0.001, infinity), nearest) ? nearest.t : infinity;
+            // As a cosine weighted bounce ray, so direct light is left to the light samples
+            return ray_colour(bounce, depth-1, world, !sample_lights, dot(direction, rec.normal) / pi, 1);
+        });
+
+        state.type = type;
+        return e;
+    }
+
+    bool photon_caustics() const {
+        return caustic_photons > 0 && caustics && caustics->built();
+    }
+
+    bool sample_environment() const {
+        return light_sampling && environment;
+    }
+
+    // Multiple importance sampling weight of a sample from a strategy with pdf f, when
+    // another strategy with pdf g could have produced it too (Veach's power heuristic)
+    static double power_heuristic(double f, double g) {
+        return f*f / (f*f + g*g);
+    }
+
+    /* Environment sampling: light reaching the (non specular) hit rec from the environment,
+       in a direction picked in proportion to its brightness. MIS weighted against the same
+       direction being found by the bounce ray (see ray_colour). */
+    colour environment_light(const ray& r_in, const hit_record& rec, const hittable& world,
+                             const directional_tree* guide_tree) const {
+        double light_pdf;
+        auto direction = environment->sample(sample_2d(), light_pdf);
+        auto cos_surface = dot(direction, rec.normal);
+        if (light_pdf <= 0 || cos_surface <= 0)
+            return colour(0, 0, 0);
+
+        auto bsdf = rec.mat->eval(r_in, rec, direction);
+        if (bsdf.near_zero())
+            return colour(0, 0, 0);
+
+        thread_counters().rays++;
+        if (world.occluded(ray(rec.p, direction, r_in.time()), interval(0.001, infinity)))
+            return colour(0, 0, 0);
+
+        auto weight = power_heuristic(light_pdf, bounce_pdf(r_in, rec, guide_tree, direction));
+        return bsdf * environment->lookup(direction) * (cos_surface * weight / light_pdf);
+    }
+
+    /* Next event estimation: light reaching the (non specular) hit rec straight from one
+       light, picked by the light tree, through a point sampled uniformly on its surface. */
+    colour direct_light(const ray& r_in, const hit_record& rec, const hittable& world) const {
+        double pick_probability;
+        const auto& light = (*lights)[lights->pick(rec.p, sample_1d(), pick_probability)];
+
+        point3 light_point;
+        vec3 light_normal;
+        if (!light.shape->sample_surface(sample_2d(), r_in.time(), light_point, light_normal))
+            return colour(0, 0, 0);
+
+        auto to_light = light_point - rec.p;
+        auto distance_squared = to_light.length_squared();
+        auto direction = to_light / sqrt(distance_squared);
+
+        auto bsdf = rec.mat->eval(r_in, rec, direction);
+        auto cos_surface = dot(direction, rec.normal);
+        auto cos_light = -dot(direction, light_normal);
+        if (cos_surface <= 0 || cos_light <= 0 || bsdf.near_zero())
+            return colour(0, 0, 0);
+
+        // The light's side of the shadow ray, so emitted() sees which face was hit
+        ray shadow(rec.p, to_light, r_in.time());
+        hit_record light_rec;
+        light_rec.p = light_point;
+        light_rec.set_face_normal(shadow, light_normal);
+        auto emission = light.mat->emitted(shadow, light_rec);
+        if (emission.near_zero())
+            return colour(0, 0, 0);
+
+        thread_counters().rays++;
+        if (world.occluded(shadow, interval(0.001, 1 - 1e-6)))
+            return colour(0, 0, 0);
+
+        // Area pdf (1 / area) converted to solid angle as seen from rec.p
+        auto pdf = pick_probability * distance_squared / (cos_light * light.area);
+        return bsdf * emission * (cos_surface / pdf);
+    }
+
+    ray get_ray(int i, int j, vec2* film_offset = nullptr) const {
         // Get a randomly sampled camera ray for the pixel located at i, j, 
         // originating from the camera defocus disk
+        // (film_offset, if given, is set to where in the pixel it went, from its centre)
         auto pixel_centre = pixel00_loc + (i*pixel_delta_u) + (j*pixel_delta_v);
-        auto pixel_sample = pixel_centre + pixel_sample_square();
+        auto pixel_sample = pixel_centre + pixel_sample_square(film_offset);
 
-        auto ray_origin = (defocus_angle <= 0) ? centre : defocus_disk_sample();
+        point3 ray_origin = centre;
+        if (defocus_angle > 0)
+            ray_origin = defocus_disk_sample();
+        else
+            skip_dimensions(2); // Keep the time in the same dimension either way
         auto ray_direction = pixel_sample - ray_origin;
 
-        auto ray_time = random_double();
+        auto ray_time = sample_1d();
 
         return ray(ray_origin, ray_direction, ray_time);
     }
 
     point3 defocus_disk_sample() const {
         // Return a random point in the camera defocus disk
-        auto p = random_in_unit_disk();
+        auto p = sample_unit_disk();
         return centre + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
     }
 
-    vec3 pixel_sample_square() const {
+    vec3 pixel_sample_square(vec2* film_offset = nullptr) const {
         // Returns a random point within a pixel (the square surrounding the pixel's centre)
 
-        auto px = -0.5 + random_double();
-        auto py = -0.5 + random_double();
-        return (px * pixel_delta_u) + (px * pixel_delta_v);
+        auto offset = sample_2d();
+        auto px = -0.5 + offset[0];
+        auto py = -0.5 + offset[1];
+        if (film_offset)
+            *film_offset = vec2(px, py);
+        return (px * pixel_delta_u) + (py * pixel_delta_v);
     }
 };
 
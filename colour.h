@@ -11,7 +11,8 @@
    and to use square root to return from gamma space to linear space.
 */
 inline double linear_to_gamma(double linear_component) {
-    return sqrt(linear_component);
+    // (Filters with negative lobes can leave a pixel slightly below 0)
+    return linear_component > 0 ? sqrt(linear_component) : 0;
 }
 
 /* Writes colour to output stream in PPM format. */
@@ -0,0 +1,329 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "framebuffer.h"
+#include "hittable_list.h"
+#include "scenes.h"
+#include "settings.h"
+#include "sockets.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Render daemon: a long running process that renders jobs sent to a Unix domain socket.
+
+   Loading a model and building its BVH is done once per scene and kept for later jobs,
+   so repeat renders of an asset (e.g. from different cameras) go straight to rendering.
+   Scenes are cached by the full path, size and modification time of the model and of the
+   files it pulls in (an OBJ's material libraries and the textures they name), so editing
+   any of them on disk is picked up by the next job, and identical models in different
+   directories are kept apart. Only the file times are checked on each job; the model is
+   read for its dependencies again only once it has changed.
+
+   Each job is one line of settings (see settings.h):
+     scene=<name or path> out=<image.ppm> [camera settings...]
+   e.g.
+     scene=./test_objects/suzanne.obj out=front.ppm lookfrom=0,0,1.5 spp=16
+   Camera settings not given keep the defaults of the scene. The reply is one line, either
+     OK cached=<0|1> load=<ms> render=<ms>
+     ERROR <message>
+   The line "shutdown" stops the daemon.
+   Every client gets its own thread, so a client keeping its connection open does not lock
+   out the others, but jobs are still run one at a time (each using all the render threads)
+   and wait their turn in the order they arrive. On shutdown the daemon stops taking
+   connections and jobs, lets the job in progress finish, and waits for its clients to go.
+*/
+
+class render_daemon {
+    public:
+        std::string socket_path = "/tmp/rtweekend_daemon.sock";
+        int threads = 0; // Render threads (0 uses one per hardware thread)
+        size_t max_scenes = 8; // Least recently used scenes are dropped past this many
+
+        // Serves jobs until told to shut down. Returns a process exit code.
+        int run() {
+            std::signal(SIGPIPE, SIG_IGN);
+
+            int listen_fd = listen_unix(socket_path);
+            if (listen_fd < 0)
+                return 1;
+            std::cerr << "Render daemon listening on " << socket_path << std::endl;
+
+            while (true) {
+                int fd = accept(listen_fd, nullptr, nullptr);
+                if (fd < 0)
+                    continue;
+
+                std::lock_guard<std::mutex> lock(clients_mutex);
+                if (stopping) {
+                    close(fd);
+                    break;
+                }
+                client_fds.insert(fd);
+                std::thread(&render_daemon::serve_client, this, fd).detach();
+            }
+
+            std::unique_lock<std::mutex> lock(clients_mutex);
+            clients_gone.wait(lock, [this] { return client_fds.empty(); });
+            close(listen_fd);
+            unlink(socket_path.c_str());
+            return 0;
+        }
+
+    private:
+        struct cached_scene {
+            hittable_list world;
+            camera cam; // The scene's default camera
+            uint64_t last_used;
+        };
+
+        std::map<std::string, cached_scene> scenes; // Keyed by scene_key (guarded by job_mutex)
+        uint64_t jobs_run = 0;
+        std::mutex job_mutex; // Held while a job runs
+
+        std::mutex clients_mutex; // Guards client_fds, and stopping being set
+        std::condition_variable clients_gone;
+        std::set<int> client_fds; // Connections still being served
+        std::atomic<bool> stopping{false};
+
+        // Runs the jobs of one connection until the client hangs up or the daemon stops
+        void serve_client(int fd) {
+            std::string line;
+            while (read_line(fd, line)) {
+                if (line == "shutdown") {
+                    write_reply(fd, "OK shutting down");
+                    stop();
+                    break;
+                }
+                if (!line.empty())
+                    write_reply(fd, run_job(line));
+            }
+
+            std::lock_guard<std::mutex> lock(clients_mutex);
+            client_fds.erase(fd);
+            close(fd);
+            clients_gone.notify_all();
+        }
+
+        /* Stops taking jobs: the reading side of every connection is shut, which ends the
+           clients' loops once they are done with the job they are on, and a connection of
+           our own wakes the accept loop to see that it has to stop. */
+        void stop() {
+            {
+                std::lock_guard<std::mutex> lock(clients_mutex);
+                if (stopping)
+                    return;
+                stopping = true;
+                for (int fd : client_fds)
+                    shutdown(fd, SHUT_RD);
+            }
+            int wake = connect_unix(socket_path);
+            if (wake >= 0)
+                close(wake);
+        }
+
+        static void write_reply(int fd, const std::string& reply) {
+            std::string line = reply + '\n';
+            write_all(fd, line.data(), line.size());
+        }
+
+        // Files each model pulls in, by the model's file_stamp (guarded by job_mutex)
+        std::map<std::string, std::vector<std::string>> dependency_lists;
+
+        // The name itself for the built in scenes, else the file_stamps of the model file and its dependencies
+        bool scene_key(const std::string& name, std::string& key) {
+            if (find_builtin_scene(name)) {
+                key = "builtin:" + name;
+                return true;
+            }
+
+            std::string stamp;
+            if (!file_stamp(name, stamp))
+                return false;
+
+            auto found = dependency_lists.find(stamp);
+            if (found == dependency_lists.end()) {
+                if (dependency_lists.size() >= 256) // Stamps of models edited since
+                    dependency_lists.clear();
+                found = dependency_lists.emplace(stamp, model_dependencies(name)).first;
+            }
+
+            key = "file:" + stamp;
+            for (const auto& file : found->second) {
+                std::string dependency;
+                key += '\n' + (file_stamp(file, dependency) ? dependency : file + " missing");
+            }
+            return true;
+        }
+
+        // "<full path> <size> <modification time>" of a file. False if it does not exist.
+        static bool file_stamp(const std::string& path, std::string& stamp) {
+            struct stat info;
+            if (stat(path.c_str(), &info) != 0)
+                return false;
+
+            char* full_path = realpath(path.c_str(), nullptr);
+            std::ostringstream text;
+            text << (full_path ? full_path : path) << ' ' << info.st_size << ' '
+                 << info.st_mtim.tv_sec << '.' << std::setw(9) << std::setfill('0') << info.st_mtim.tv_nsec;
+            std::free(full_path);
+            stamp = text.str();
+            return true;
+        }
+
+        /* Files an OBJ model pulls in: its mtllib material libraries (relative to the model)
+           and the texture maps those name (relative to the library). Other formats have
+           none that are tracked. */
+        static std::vector<std::string> model_dependencies(const std::string& path) {
+            std::vector<std::string> files;
+            if (path.size() < 4 || path.compare(path.size() - 4, 4, ".obj") != 0)
+                return files;
+
+            auto directory = [](const std::string& file) { return file.substr(0, file.find_last_of('/') + 1); };
+            std::string line, keyword, value;
+            std::ifstream model(path);
+            while (std::getline(model, line)) {
+                std::istringstream words(line);
+                if (words >> keyword && keyword == "mtllib")
+                    while (words >> value)
+                        files.push_back(directory(path) + value);
+            }
+
+            for (size_t library = 0, libraries = files.size(); library < libraries; library++) {
+                std::ifstream materials(files[library]);
+                while (std::getline(materials, line)) {
+                    std::istringstream words(line);
+                    if (!(words >> keyword) || (keyword.compare(0, 4, "map_") != 0 && keyword != "bump"
+                                                && keyword != "disp" && keyword != "norm" && keyword != "refl"))
+                        continue;
+                    // The file name comes last, after any options
+                    std::string texture;
+                    while (words >> value)
+                        texture = value;
+                    if (!texture.empty())
+                        files.push_back(directory(files[library]) + texture);
+                }
+            }
+            return files;
+        }
+
+        // Returns the scene, loading (and caching) it if needed. nullptr if it could not be loaded.
+        cached_scene* get_scene(const std::string& name, bool& cached) {
+            std::string key;
+            if (!scene_key(name, key))
+                return nullptr;
+
+            auto found = scenes.find(key);
+            cached = found != scenes.end();
+            if (!cached) {
+                cached_scene scene;
+                if (!load_scene(name, scene.world, scene.cam))
+                    return nullptr;
+                evict_scenes();
+                found = scenes.emplace(key, std::move(scene)).first;
+            }
+            found->second.last_used = jobs_run;
+            return &found->second;
+        }
+
+        // Drops least recently used scenes to make room for a new one
+        void evict_scenes() {
+            while (!scenes.empty() && scenes.size() >= max_scenes) {
+                auto oldest = scenes.begin();
+                for (auto s = scenes.begin(); s != scenes.end(); ++s)
+                    if (s->second.last_used < oldest->second.last_used)
+                        oldest = s;
+                scenes.erase(oldest);
+            }
+        }
+
+        std::string run_job(const std::string& line) {
+            std::lock_guard<std::mutex> lock(job_mutex);
+            if (stopping)
+                return "ERROR the daemon is shutting down";
+            jobs_run++;
+
+            std::vector<setting> settings;
+            if (!parse_settings(line, settings))
+                return "ERROR could not parse job '" + line + "'";
+
+            std::string scene_name, output;
+            for (auto& s : settings) {
+                if (s.first == "scene") scene_name = s.second;
+                if (s.first == "out") output = s.second;
+            }
+            if (scene_name.empty() || output.empty())
+                return "ERROR job needs scene=... and out=...";
+
+            auto load_start = std::chrono::steady_clock::now();
+            bool cached;
+            auto scene = get_scene(scene_name, cached);
+            if (!scene)
+                return "ERROR could not load scene " + scene_name;
+            auto load_finish = std::chrono::steady_clock::now();
+
+            camera cam = scene->cam;
+            cam.threads = threads;
+            for (auto& s : settings) {
+                if (s.first == "scene" || s.first == "out") continue;
+                if (!apply_camera_setting(cam, s.first, s.second))
+                    return "ERROR bad setting " + s.first + "=" + s.second;
+            }
+
+            framebuffer image;
+            cam.render(scene->world, image, 0, cam.samples_per_pixel);
+            auto render_finish = std::chrono::steady_clock::now();
+
+            std::ofstream file(output);
+            image.write_ppm(file);
+            if (!file)
+                return "ERROR could not write " + output;
+
+            using std::chrono::duration_cast;
+            using std::chrono::milliseconds;
+            std::ostringstream reply;
+            reply << "OK cached=" << cached
+                  << " load=" << duration_cast<milliseconds>(load_finish - load_start).count() << "ms"
+                  << " render=" << duration_cast<milliseconds>(render_finish - load_finish).count() << "ms";
+            return reply.str();
+        }
+};
+
+// Sends one job (or "shutdown") to a running daemon and prints its reply. Returns an exit code.
+inline int submit_daemon_job(const std::string& socket_path, const std::string& job) {
+    int fd = connect_unix(socket_path);
+    if (fd < 0)
+        return 1;
+
+    std::string line = job + '\n';
+    std::string reply;
+    bool ok = write_all(fd, line.data(), line.size()) && read_line(fd, reply);
+    close(fd);
+
+    std::cout << reply << std::endl;
+    return ok && reply.compare(0, 2, "OK") == 0 ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,251 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include "rtweekend.h"
+
+#include "framebuffer.h"
+#include "tile.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Edge-avoiding a-trous wavelet denoiser (Dammertz, Sewtz, Hanika & Lensch 2010), guided by
+   the albedo, normal and depth AOVs (see framebuffer.h).
+
+   Each pass blurs every pixel with a 5x5 B3 spline kernel whose taps are spaced step pixels
+   apart, step doubling from pass to pass (1, 2, 4, 8, 16), so five passes cover an 81 pixel
+   wide neighbourhood with only 25 taps each. Every tap is weighted down by how different
+   it is from the centre pixel in colour, normal, depth and albedo, so the blur stays within
+   a surface and stops at its edges. The colour tolerance halves each pass: later, wider
+   passes only average what is already similar.
+
+   The image is divided by the albedo first and multiplied back after, so textures and
+   coloured objects are kept sharp while the lighting on them is smoothed. Colours are
+   compared after x / (1 + x) tone mapping, so the tolerances work for any brightness.
+
+   The passes run on float planes (one array per channel), split into bands of rows over
+   the render threads. With SSE2 four neighbouring pixels of a row are filtered at once,
+   exp included; pixels whose taps would leave the image at the sides are done one at a
+   time with clamped taps. */
+class atrous_denoiser {
+    public:
+        int passes = 5;
+        float colour_sigma = 0.1f; // Tolerances of the edge stopping weights exp(-d^2 / sigma^2)
+        float normal_sigma = 0.3f;
+        float depth_sigma = 0.04f; // Relative to the centre pixel's depth
+        float albedo_sigma = 0.1f;
+
+        /* Replaces the colours of image (which needs AOVs) with denoised ones, keeping the
+           sample counts and weights. Returns false if the image has no AOVs. */
+        bool run(framebuffer& image, int thread_count) const {
+            if (!image.has_aovs())
+                return false;
+            int width = image.width, height = image.height;
+            auto size = static_cast<size_t>(width) * height;
+
+            planes current(size);
+            std::vector<float> modulation[3], filtered[3];
+            for (int k = 0; k < 3; k++) {
+                modulation[k].resize(size);
+                filtered[k].resize(size);
+            }
+            for (size_t index = 0; index < size; index++) {
+                const auto& aov = image.aovs[index];
+                auto c = image.average(index);
+                auto albedo = image.samples[index] > 0 ? aov.albedo / image.samples[index] : colour(0, 0, 0);
+                for (int k = 0; k < 3; k++) {
+                    // Nothing to divide by where the albedo is black (e.g. background pixels)
+                    modulation[k][index] = albedo[k] > 1e-3 ? static_cast<float>(albedo[k]) : 1.0f;
+                    // Clamped: a pixel filter's negative lobes can leave it just below 0
+                    current.colour[k][index] = static_cast<float>(std::max(c[k], 0.0)) / modulation[k][index];
+                    current.albedo[k][index] = static_cast<float>(albedo[k]);
+                }
+                auto n = aov.hits > 0 ? unit_vector(aov.normal) : vec3(0, 0, 0);
+                for (int k = 0; k < 3; k++)
+                    current.normal[k][index] = static_cast<float>(n[k]);
+                // Background is "very far", so it never mixes with surfaces
+                current.depth[index] = aov.hits > 0 ? static_cast<float>(aov.depth / aov.hits) : 1e30f;
+            }
+
+            const int band = 8;
+            auto bands = static_cast<size_t>((height + band - 1) / band);
+            for (int pass = 0; pass < passes; pass++) {
+                int step = 1 << pass;
+                float colour_scale = static_cast<float>(1 << (2 * pass)) / (colour_sigma * colour_sigma);
+                for (int k = 0; k < 3; k++)
+                    for (size_t index = 0; index < size; index++)
+                        current.mapped[k][index] = current.colour[k][index] / (1 + current.colour[k][index]);
+
+                run_tile_jobs(bands, thread_count, [&](size_t b) {
+                    for (int y = static_cast<int>(b) * band; y < std::min(height, static_cast<int>(b + 1) * band); y++)
+                        filter_row(current, filtered, width, height, y, step, colour_scale);
+                }, nullptr, false);
+                for (int k = 0; k < 3; k++)
+                    std::swap(current.colour[k], filtered[k]);
+            }
+
+            for (size_t index = 0; index < size; index++) {
+                colour c(current.colour[0][index] * modulation[0][index],
+                         current.colour[1][index] * modulation[1][index],
+                         current.colour[2][index] * modulation[2][index]);
+                image.sum[index] = c * image.weight(index);
+            }
+            return true;
+        }
+
+    private:
+        struct planes {
+            std::vector<float> colour[3]; // Divided by the albedo
+            std::vector<float> mapped[3]; // colour / (1 + colour), for the colour weights
+            std::vector<float> normal[3];
+            std::vector<float> depth;
+            std::vector<float> albedo[3];
+
+            planes(size_t size) : depth(size) {
+                for (int k = 0; k < 3; k++) {
+                    colour[k].resize(size);
+                    mapped[k].resize(size);
+                    normal[k].resize(size);
+                    albedo[k].resize(size);
+                }
+            }
+        };
+
+        void filter_row(const planes& in, std::vector<float>* out, int width, int height, int y, int step,
+                        float colour_scale) const {
+            int x = 0;
+            // Clamped taps on the left, four pixels at a time in the middle, clamped on the right
+            for (; x < std::min(width, 2 * step); x++)
+                filter<float>(in, out, width, height, x, y, step, colour_scale);
+#if defined(__SSE2__)
+            for (; x + 3 + 2 * step < width; x += 4)
+                filter<__m128>(in, out, width, height, x, y, step, colour_scale);
+#endif
+            for (; x < width; x++)
+                filter<float>(in, out, width, height, x, y, step, colour_scale);
+        }
+
+        /* Filters the pixel at x, y (T = float) or the four from x on (T = __m128, only where
+           all their taps are inside the row, so no tap needs clamping sideways) into out */
+        template <typename T>
+        void filter(const planes& in, std::vector<float>* out, int width, int height, int x, int y, int step,
+                    float colour_scale) const {
+            static const float kernel[5] = {1.0f/16, 1.0f/4, 3.0f/8, 1.0f/4, 1.0f/16};
+            auto p = static_cast<size_t>(y) * width + x;
+
+            T mapped[3], normal[3], albedo[3];
+            for (int k = 0; k < 3; k++) {
+                mapped[k] = load<T>(&in.mapped[k][p]);
+                normal[k] = load<T>(&in.normal[k][p]);
+                albedo[k] = load<T>(&in.albedo[k][p]);
+            }
+            T depth = load<T>(&in.depth[p]);
+            T inverse_depth = div(splat<T>(1.0f), mul(depth, splat<T>(depth_sigma)));
+            float normal_scale = 1 / (normal_sigma * normal_sigma);
+            float albedo_scale = 1 / (albedo_sigma * albedo_sigma);
+
+            T weight_sum = splat<T>(0.0f);
+            T sum[3] = {splat<T>(0.0f), splat<T>(0.0f), splat<T>(0.0f)};
+            for (int dy = -2; dy <= 2; dy++) {
+                auto qy = std::clamp(y + dy * step, 0, height - 1);
+                for (int dx = -2; dx <= 2; dx++) {
+                    auto qx = std::clamp(x + dx * step, 0, width - 1);
+                    auto q = static_cast<size_t>(qy) * width + qx;
+
+                    T colour_distance = splat<T>(0.0f), normal_distance = splat<T>(0.0f);
+                    T albedo_distance = splat<T>(0.0f);
+                    for (int k = 0; k < 3; k++) {
+                        T d = sub(load<T>(&in.mapped[k][q]), mapped[k]);
+                        colour_distance = add(colour_distance, mul(d, d));
+                        d = sub(load<T>(&in.normal[k][q]), normal[k]);
+                        normal_distance = add(normal_distance, mul(d, d));
+                        d = sub(load<T>(&in.albedo[k][q]), albedo[k]);
+                        albedo_distance = add(albedo_distance, mul(d, d));
+                    }
+                    T d = mul(sub(load<T>(&in.depth[q]), depth), inverse_depth);
+                    T exponent = add(add(add(mul(colour_distance, splat<T>(colour_scale)),
+                                             mul(normal_distance, splat<T>(normal_scale))),
+                                         mul(d, d)),
+                                     mul(albedo_distance, splat<T>(albedo_scale)));
+                    T weight = mul(fast_exp(sub(splat<T>(0.0f), exponent)), splat<T>(kernel[dx + 2] * kernel[dy + 2]));
+
+                    weight_sum = add(weight_sum, weight);
+                    for (int k = 0; k < 3; k++)
+                        sum[k] = add(sum[k], mul(weight, load<T>(&in.colour[k][q])));
+                }
+            }
+            // The centre tap always has weight kernel^2 > 0, so weight_sum is never 0
+            for (int k = 0; k < 3; k++)
+                store(&out[k][p], div(sum[k], weight_sum));
+        }
+
+        /* Loads, stores and arithmetic on a float or an SSE vector of four. Written as
+           functions (not operators on __m128, which only GCC and Clang provide) so any
+           compiler with the SSE intrinsics builds the vector path. */
+        template <typename T> static T load(const float* p);
+        template <typename T> static T splat(float v);
+        static void store(float* p, float v) { *p = v; }
+        static float add(float a, float b) { return a + b; }
+        static float sub(float a, float b) { return a - b; }
+        static float mul(float a, float b) { return a * b; }
+        static float div(float a, float b) { return a / b; }
+
+        /* exp(x) for x <= 0, to about 2e-5 relative: 2^(x log2 e), split into an integer
+           power of two (put straight into the exponent bits) and 2^f for f in [0, 1) by a
+           polynomial. Very negative x are clamped to -80 (negligible next to the centre tap). */
+        static float fast_exp(float x) {
+            auto t = std::max(x, -80.0f) * 1.4426950408889634f;
+            auto i = static_cast<int32_t>(std::floor(t));
+            auto f = t - i;
+            auto p = exp2_fraction(f);
+            uint32_t bits = static_cast<uint32_t>(i + 127) << 23;
+            float scale;
+            std::memcpy(&scale, &bits, sizeof scale);
+            return p * scale;
+        }
+
+        // 2^f for f in [0, 1): Taylor series of e^(f ln 2) to f^6 (T is float or __m128)
+        template <typename T>
+        static T exp2_fraction(T f) {
+            T p = add(mul(f, splat<T>(1.5403530e-4f)), splat<T>(1.3333558e-3f));
+            p = add(mul(p, f), splat<T>(9.6181291e-3f));
+            p = add(mul(p, f), splat<T>(5.5504109e-2f));
+            p = add(mul(p, f), splat<T>(2.4022651e-1f));
+            p = add(mul(p, f), splat<T>(6.9314718e-1f));
+            return add(mul(p, f), splat<T>(1.0f));
+        }
+
+#if defined(__SSE2__)
+        static void store(float* p, __m128 v) { _mm_storeu_ps(p, v); }
+        static __m128 add(__m128 a, __m128 b) { return _mm_add_ps(a, b); }
+        static __m128 sub(__m128 a, __m128 b) { return _mm_sub_ps(a, b); }
+        static __m128 mul(__m128 a, __m128 b) { return _mm_mul_ps(a, b); }
+        static __m128 div(__m128 a, __m128 b) { return _mm_div_ps(a, b); }
+
+        static __m128 fast_exp(__m128 x) {
+            auto t = _mm_mul_ps(_mm_max_ps(x, _mm_set1_ps(-80.0f)), _mm_set1_ps(1.4426950408889634f));
+            // Floor: truncation rounds the (negative) values up, so step back one where it did
+            auto truncated = _mm_cvttps_epi32(t);
+            auto rounded_up = _mm_cmpgt_ps(_mm_cvtepi32_ps(truncated), t);
+            auto i = _mm_add_epi32(truncated, _mm_castps_si128(rounded_up)); // -1 where rounded up
+            auto f = _mm_sub_ps(t, _mm_cvtepi32_ps(i));
+            auto scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(i, _mm_set1_epi32(127)), 23));
+            return _mm_mul_ps(exp2_fraction(f), scale);
+        }
+#endif
+};
+
+template <> inline float atrous_denoiser::load<float>(const float* p) { return *p; }
+template <> inline float atrous_denoiser::splat<float>(float v) { return v; }
+#if defined(__SSE2__)
+template <> inline __m128 atrous_denoiser::load<__m128>(const float* p) { return _mm_loadu_ps(p); }
+template <> inline __m128 atrous_denoiser::splat<__m128>(float v) { return _mm_set1_ps(v); }
+#endif
+
+#endif
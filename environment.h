@@ -0,0 +1,174 @@
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include "rtweekend.h"
+
+#include "colour.h"
+#include "vec2.h"
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/* Piecewise constant 1D distribution over [0,1), for sampling in proportion to a table of
+   values (e.g. the brightness of a row of pixels). */
+class distribution_1d {
+    public:
+        distribution_1d() {}
+        distribution_1d(const double* values, int count) : func(values, values + count), cdf(count + 1) {
+            cdf[0] = 0;
+            for (int i = 0; i < count; i++)
+                cdf[i + 1] = cdf[i] + func[i] / count;
+            integral = cdf[count];
+            for (int i = 1; i <= count; i++)
+                cdf[i] = integral > 0 ? cdf[i] / integral : double(i) / count;
+        }
+
+        int size() const { return static_cast<int>(func.size()); }
+
+        // Returns x in [0,1) distributed like the values, its pdf and the index of its piece
+        double sample(double u, double& pdf, int& index) const {
+            index = static_cast<int>(std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin()) - 1;
+            index = std::clamp(index, 0, size() - 1);
+            auto width = cdf[index + 1] - cdf[index];
+            auto offset = width > 0 ? (u - cdf[index]) / width : 0.5;
+            pdf = value_pdf(index);
+            return std::min((index + offset) / size(), 0.99999999999999989);
+        }
+
+        // Density of piece index
+        double value_pdf(int index) const {
+            return integral > 0 ? func[index] / integral : 1;
+        }
+
+        double integral = 0; // Average of the values
+
+    private:
+        std::vector<double> func;
+        std::vector<double> cdf;
+};
+
+/* Environment light: an equirectangular (latitude-longitude) HDR image around the scene,
+   seen by every ray that escapes. The top row of the image is straight up (+y) and the
+   centre of the image looks down -z.
+
+   For light sampling it keeps a 2D distribution in proportion to the brightness of each
+   pixel times the solid angle it covers (a marginal distribution over the rows and a
+   conditional one for the pixels of each row), so a small bright sun gets most of the
+   samples instead of almost none. */
+class environment_map {
+    public:
+        double intensity = 1; // Scale applied to the image
+
+        // Loads an HDR (or LDR) image with stb_image. Returns false on failure.
+        bool load(const std::string& path) {
+            int channels;
+            float* data = stbi_loadf(path.c_str(), &width, &height, &channels, 3);
+            if (!data) {
+                std::cerr << "ERROR::ENVIRONMENT:: Could not load " << path << ": " << stbi_failure_reason() << std::endl;
+                return false;
+            }
+            pixels.resize(size_t(width) * height);
+            for (size_t i = 0; i < pixels.size(); i++)
+                pixels[i] = colour(data[3*i], data[3*i + 1], data[3*i + 2]);
+            stbi_image_free(data);
+
+            build_distribution();
+            return true;
+        }
+
+        // Radiance arriving from direction (bilinearly filtered)
+        colour lookup(const vec3& direction) const {
+            auto uv = direction_to_uv(unit_vector(direction));
+            // Continuous pixel coordinates, relative to pixel centres
+            auto x = uv[0] * width - 0.5;
+            auto y = uv[1] * height - 0.5;
+            auto x0 = static_cast<int>(floor(x));
+            auto y0 = static_cast<int>(floor(y));
+            auto fx = x - x0;
+            auto fy = y - y0;
+
+            return intensity * ((1 - fy) * ((1 - fx) * texel(x0, y0) + fx * texel(x0 + 1, y0))
+                                + fy * ((1 - fx) * texel(x0, y0 + 1) + fx * texel(x0 + 1, y0 + 1)));
+        }
+
+        // Picks a direction in proportion to the brightness, returning its solid angle pdf
+        vec3 sample(const vec2& u, double& pdf) const {
+            double row_pdf, column_pdf;
+            int row, column;
+            auto v = marginal.sample(u[1], row_pdf, row);
+            auto uu = conditional[row].sample(u[0], column_pdf, column);
+
+            auto direction = uv_to_direction(uu, v);
+            auto sin_theta = sin(v * pi);
+            pdf = sin_theta > 0 ? row_pdf * column_pdf / (2 * pi * pi * sin_theta) : 0;
+            return direction;
+        }
+
+        // Solid angle pdf with which sample picks direction
+        double pdf(const vec3& direction) const {
+            auto uv = direction_to_uv(unit_vector(direction));
+            auto sin_theta = sin(uv[1] * pi);
+            if (sin_theta <= 0)
+                return 0;
+            int column = std::min(static_cast<int>(uv[0] * width), width - 1);
+            int row = std::min(static_cast<int>(uv[1] * height), height - 1);
+            return marginal.value_pdf(row) * conditional[row].value_pdf(column) / (2 * pi * pi * sin_theta);
+        }
+
+    private:
+        int width = 0, height = 0;
+        std::vector<colour> pixels;
+        distribution_1d marginal; // Over rows
+        std::vector<distribution_1d> conditional; // Over the pixels of each row
+
+        // Wraps around horizontally, clamps vertically
+        const colour& texel(int x, int y) const {
+            x = ((x % width) + width) % width;
+            y = std::clamp(y, 0, height - 1);
+            return pixels[size_t(y) * width + x];
+        }
+
+        static vec2 direction_to_uv(const vec3& d) {
+            auto phi = atan2(d.x(), -d.z()); // -pi..pi, 0 looking down -z
+            auto theta = acos(std::clamp(d.y(), -1.0, 1.0)); // 0 straight up
+            return vec2((phi + pi) / (2 * pi), theta / pi);
+        }
+
+        static vec3 uv_to_direction(double u, double v) {
+            auto phi = u * 2 * pi - pi;
+            auto theta = v * pi;
+            return vec3(sin(theta) * sin(phi), cos(theta), -sin(theta) * cos(phi));
+        }
+
+        void build_distribution() {
+            std::vector<double> row_values(height);
+            std::vector<double> values(width);
+            conditional.clear();
+
+            // A floor of a small fraction of the average keeps every direction samplable, as
+            // the bilinear lookup can be bright where a single pixel is black
+            double average = 0;
+            for (auto& p : pixels)
+                average += luminance(p);
+            average /= pixels.size();
+
+            for (int y = 0; y < height; y++) {
+                auto sin_theta = sin(pi * (y + 0.5) / height); // Solid angle of the row's pixels
+                for (int x = 0; x < width; x++)
+                    values[x] = (luminance(pixels[size_t(y) * width + x]) + 0.01 * average) * sin_theta;
+                conditional.emplace_back(values.data(), width);
+                row_values[y] = conditional.back().integral;
+            }
+            marginal = distribution_1d(row_values.data(), height);
+        }
+
+        static double luminance(const colour& c) {
+            return 0.2126*c.x() + 0.7152*c.y() + 0.0722*c.z();
+        }
+};
+
+#endif
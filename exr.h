@@ -0,0 +1,134 @@
+#ifndef EXR_H
+#define EXR_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/* Minimal OpenEXR writer: one part, scanlines, no compression, 32 bit float or unsigned int
+   channels. That is all compositing and denoising tools need to read our layers, and it
+   keeps us free of the OpenEXR library. Layers follow the usual naming, "layer.channel"
+   (e.g. albedo.R), with the main image as plain R, G, B.
+   (File layout: https://openexr.com/en/latest/OpenEXRFileLayout.html) */
+class exr_image {
+    public:
+        exr_image(int width, int height) : width(width), height(height) {}
+
+        // Adds a float channel; values holds width * height pixels, top row first
+        void add_channel(const std::string& name, std::vector<float> values) {
+            channels.push_back(channel{name, float_type, std::move(values), {}});
+        }
+
+        void add_channel(const std::string& name, std::vector<uint32_t> values) {
+            channels.push_back(channel{name, uint_type, {}, std::move(values)});
+        }
+
+        bool write(const std::string& path) const {
+            // Readers expect the channels sorted by name, in the header and in the pixel data
+            auto sorted = channels;
+            std::sort(sorted.begin(), sorted.end(),
+                      [](const channel& a, const channel& b) { return a.name < b.name; });
+
+            std::string out;
+            out += std::string("\x76\x2f\x31\x01", 4); // Magic number
+            put_int32(out, 2); // Version 2, single part scanline file
+
+            std::string list;
+            for (const auto& c : sorted) {
+                list += c.name + '\0';
+                put_int32(list, c.type);
+                list += std::string(4, '\0'); // pLinear and reserved
+                put_int32(list, 1); // x and y sampling
+                put_int32(list, 1);
+            }
+            list += '\0';
+            put_attribute(out, "channels", "chlist", list);
+            put_attribute(out, "compression", "compression", std::string(1, '\0')); // None
+
+            std::string window;
+            for (int v : {0, 0, width - 1, height - 1})
+                put_int32(window, v);
+            put_attribute(out, "dataWindow", "box2i", window);
+            put_attribute(out, "displayWindow", "box2i", window);
+            put_attribute(out, "lineOrder", "lineOrder", std::string(1, '\0')); // Increasing y
+            std::string one, centre;
+            put_float(one, 1);
+            put_float(centre, 0);
+            put_float(centre, 0);
+            put_attribute(out, "pixelAspectRatio", "float", one);
+            put_attribute(out, "screenWindowCenter", "v2f", centre);
+            put_attribute(out, "screenWindowWidth", "float", one);
+            out += '\0'; // End of header
+
+            // Offset table: where each scanline's chunk starts in the file
+            auto line_size = 4 * width * static_cast<uint64_t>(sorted.size());
+            auto first_chunk = out.size() + 8 * static_cast<uint64_t>(height);
+            for (int y = 0; y < height; y++)
+                put_uint64(out, first_chunk + y * (8 + line_size));
+
+            for (int y = 0; y < height; y++) {
+                put_int32(out, y);
+                put_int32(out, static_cast<int32_t>(line_size));
+                for (const auto& c : sorted) {
+                    for (int x = 0; x < width; x++) {
+                        auto index = static_cast<size_t>(y) * width + x;
+                        if (c.type == float_type)
+                            put_float(out, c.floats[index]);
+                        else
+                            put_uint32(out, c.uints[index]);
+                    }
+                }
+            }
+
+            std::ofstream file(path, std::ios::binary);
+            file.write(out.data(), out.size());
+            if (!file) {
+                std::cerr << "ERROR::EXR:: Could not write " << path << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        static const int32_t uint_type = 0;
+        static const int32_t float_type = 2;
+
+        struct channel {
+            std::string name;
+            int32_t type;
+            std::vector<float> floats;
+            std::vector<uint32_t> uints;
+        };
+
+        int width, height;
+        std::vector<channel> channels;
+
+        // EXR is little endian whatever the host is
+        static void put_uint32(std::string& out, uint32_t v) {
+            for (int b = 0; b < 4; b++)
+                out += static_cast<char>((v >> (8 * b)) & 0xff);
+        }
+        static void put_int32(std::string& out, int32_t v) { put_uint32(out, static_cast<uint32_t>(v)); }
+        static void put_uint64(std::string& out, uint64_t v) {
+            put_uint32(out, static_cast<uint32_t>(v));
+            put_uint32(out, static_cast<uint32_t>(v >> 32));
+        }
+        static void put_float(std::string& out, float v) {
+            uint32_t bits;
+            std::memcpy(&bits, &v, 4);
+            put_uint32(out, bits);
+        }
+
+        static void put_attribute(std::string& out, const std::string& name, const std::string& type,
+                                  const std::string& value) {
+            out += name + '\0' + type + '\0';
+            put_int32(out, static_cast<int32_t>(value.size()));
+            out += value;
+        }
+};
+
+#endif
@@ -0,0 +1,390 @@
+#ifndef FARM_H
+#define FARM_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "progress.h"
+#include "sockets.h"
+#include "tile.h"
+
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Tile farm: renders an image with worker processes instead of threads.
+
+   The coordinator loads the scene once, forks the workers (which inherit the scene) and
+   then hands out tiles over a Unix domain socket. Workers can also be started separately
+   with ./main --farm-worker <socket>, in which case they load the scene themselves.
+
+   Protocol (every message starts with a farm_message header):
+     worker -> coordinator: farm_request              (ready for a tile)
+                            farm_result + pixel sums  (finished a tile, ready for another)
+     coordinator -> worker: farm_tile                 (render this tile)
+                            farm_done                 (no work left, disconnect)
+
+   Workers are given tiles from a shared queue as they become free. Once the queue is
+   empty, free workers steal a copy of the longest running tile of another worker, so a slow
+   (or hung) worker does not hold up the end of the render. Whichever copy finishes first is
+   used; the seeding in camera::render_pixel makes both copies identical anyway. If a worker
+   dies its tile goes back in the queue, and a replacement worker is forked.
+   Results carry the worker's counters and time for the tile, so the coordinator reports
+   progress and throughput like a threaded render, with a slot per worker.
+*/
+
+enum farm_message_type : uint32_t {
+    farm_request = 1,
+    farm_tile = 2,
+    farm_result = 3,
+    farm_done = 4
+};
+
+struct farm_message {
+    uint32_t type;
+    uint32_t tile_index;
+    tile bounds;
+    int32_t sample_begin;
+    int32_t sample_end;
+    render_counters work; // Results: what the tile took to render
+    uint64_t busy_ns; // Results: time spent on the tile
+};
+
+/* Worker side of the farm. Connects to the coordinator and renders tiles until it is told
+   there is no work left. Returns 0 on a clean finish. */
+inline int run_farm_worker(const std::string& socket_path, const hittable& world, camera& cam) {
+    int fd = connect_unix(socket_path);
+    if (fd < 0)
+        return 1;
+
+    cam.initialize();
+
+    farm_message message{};
+    message.type = farm_request;
+    std::vector<colour> pixels;
+
+    // Only the first tile is asked for on its own: each result asks for the next one
+    bool connected = write_all(fd, &message, sizeof(message));
+    while (connected && read_all(fd, &message, sizeof(message)) && message.type == farm_tile) {
+        const tile& t = message.bounds;
+        auto start = std::chrono::steady_clock::now();
+        auto before = thread_counters();
+        pixels.clear();
+        for (int j = t.y0; j < t.y1; ++j)
+            for (int i = t.x0; i < t.x1; ++i)
+                pixels.push_back(cam.render_pixel(world, i, j, message.sample_begin, message.sample_end));
+
+        const auto& after = thread_counters();
+        message.type = farm_result;
+        message.work.samples = after.samples - before.samples;
+        message.work.rays = after.rays - before.rays;
+        message.work.nodes_visited = after.nodes_visited - before.nodes_visited;
+        message.busy_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        connected = write_all(fd, &message, sizeof(message))
+                 && write_all(fd, pixels.data(), pixels.size() * sizeof(colour));
+    }
+
+    close(fd);
+    return message.type == farm_done ? 0 : 1;
+}
+
+class tile_farm {
+    public:
+        int workers = 4; // Number of worker processes to fork
+        std::string socket_path = "/tmp/rtweekend_farm.sock";
+        int max_restarts = 8; // Give up replacing crashed workers after this many
+
+        /* Renders samples [sample_begin, sample_end) of every pixel into image using the worker
+           processes. Returns false if the render could not be completed. */
+        bool render(const hittable& world, camera& cam, framebuffer& image, int sample_begin, int sample_end) {
+            auto start_time = std::chrono::steady_clock::now();
+
+            world_ptr = &world;
+            cam_ptr = &cam;
+            cam.initialize();
+            image = framebuffer(cam.image_width, cam.height());
+            tiles = make_tiles(cam.image_width, cam.height(), cam.tile_size);
+            tile_finished.assign(tiles.size(), false);
+            tile_copies.assign(tiles.size(), 0);
+            pending.clear();
+            for (size_t t = 0; t < tiles.size(); t++)
+                pending.push_back(t);
+            tiles_left = tiles.size();
+            restarts = 0;
+            bytes_received = 0;
+
+            // A worker dying mid write must not kill the coordinator (or other workers)
+            std::signal(SIGPIPE, SIG_IGN);
+
+            listen_fd = listen_unix(socket_path);
+            if (listen_fd < 0)
+                return false;
+
+            for (int w = 0; w < workers; w++)
+                fork_worker();
+
+            progress_reporter progress(tiles.size(), workers, cam.show_progress);
+            progress.start();
+            bool ok = serve(image, sample_begin, sample_end, progress);
+            progress.stop();
+
+            // Tell everyone still connected to stop. Forked workers still busy with a stolen
+            // copy of a tile are no longer needed, so they are stopped too.
+            for (auto& connection : connections) {
+                farm_message done{};
+                done.type = farm_done;
+                write_all(connection.fd, &done, sizeof(done));
+                close(connection.fd);
+            }
+            connections.clear();
+            close(listen_fd);
+            unlink(socket_path.c_str());
+            for (auto pid : children)
+                kill(pid, SIGTERM);
+            for (auto pid : children)
+                waitpid(pid, nullptr, 0);
+            children.clear();
+
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start_time).count();
+            std::cerr << "Farm: " << tiles.size() << " tiles, " << workers << " workers, "
+                      << restarts << " restarts, " << bytes_received / (1024*1024.0) << " MiB received, "
+                      << elapsed << "ms" << std::endl;
+            return ok;
+        }
+
+    private:
+        struct connection {
+            int fd;
+            int slot; // Progress slot (see free_slot)
+            long tile = -1; // Tile being rendered (-1 if none)
+            bool idle = false; // True if the worker asked for work and got none
+            std::chrono::steady_clock::time_point assigned_at;
+        };
+
+        std::vector<tile> tiles;
+        std::vector<bool> tile_finished;
+        std::vector<int> tile_copies; // Number of workers currently rendering each tile
+        std::deque<size_t> pending; // Tiles not yet handed out (or handed back by dead workers)
+        size_t tiles_left = 0;
+        std::vector<connection> connections;
+        std::vector<pid_t> children; // Forked workers that have not been reaped yet
+        int listen_fd = -1;
+        int restarts = 0;
+        size_t bytes_received = 0;
+        const hittable* world_ptr = nullptr;
+        camera* cam_ptr = nullptr;
+
+        void fork_worker() {
+            std::cout.flush();
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(listen_fd);
+                for (auto& c : connections)
+                    close(c.fd);
+                _exit(run_farm_worker(socket_path, *world_ptr, *cam_ptr));
+            }
+            if (pid < 0)
+                std::cerr << "ERROR::FARM:: fork failed: " << std::strerror(errno) << std::endl;
+            else
+                children.push_back(pid);
+        }
+
+        // Reaps forked workers that have exited. Returns the number still running.
+        size_t reap_children() {
+            for (size_t c = 0; c < children.size();) {
+                if (waitpid(children[c], nullptr, WNOHANG) == children[c])
+                    children.erase(children.begin() + c);
+                else
+                    c++;
+            }
+            return children.size();
+        }
+
+        // Forks a replacement worker unless we have already restarted too many
+        bool restart_worker() {
+            if (restarts >= max_restarts)
+                return false;
+            restarts++;
+            fork_worker();
+            return true;
+        }
+
+        // A progress slot no connected worker is using (replacements take over dead workers' slots)
+        int free_slot() const {
+            for (int slot = 0; slot < workers; slot++) {
+                bool used = false;
+                for (auto& c : connections)
+                    used = used || c.slot == slot;
+                if (!used)
+                    return slot;
+            }
+            return 0; // More connections than workers (workers started by hand): share one
+        }
+
+        bool serve(framebuffer& image, int sample_begin, int sample_end, progress_reporter& progress) {
+            std::vector<colour> pixels;
+
+            while (tiles_left > 0) {
+                std::vector<pollfd> fds;
+                fds.push_back(pollfd{listen_fd, POLLIN, 0});
+                for (auto& c : connections)
+                    fds.push_back(pollfd{c.fd, POLLIN, 0});
+
+                // Time out now and then to notice workers that died before connecting
+                if (poll(fds.data(), fds.size(), 500) < 0) {
+                    if (errno == EINTR) continue;
+                    std::cerr << "ERROR::FARM:: poll failed: " << std::strerror(errno) << std::endl;
+                    return false;
+                }
+
+                // Go backwards so dead connections can be removed as we go
+                for (size_t f = fds.size() - 1; f >= 1 && tiles_left > 0; f--) {
+                    if (!fds[f].revents) continue;
+                    auto& c = connections[f - 1];
+
+                    farm_message message;
+                    bool alive = read_all(c.fd, &message, sizeof(message));
+                    // A worker can only send back the tile it was given. Anything else means
+                    // a broken worker or a corrupted message, so it is dropped like a dead one.
+                    if (alive && message.type == farm_result && (c.tile < 0 || static_cast<long>(message.tile_index) != c.tile)) {
+                        std::cerr << "\nERROR::FARM:: Worker sent back tile " << message.tile_index
+                                  << ", which it was not given" << std::endl;
+                        alive = false;
+                    } else if (alive && message.type != farm_result && message.type != farm_request) {
+                        std::cerr << "\nERROR::FARM:: Bad message type " << message.type << " from a worker" << std::endl;
+                        alive = false;
+                    }
+                    if (alive && message.type == farm_result) {
+                        pixels.resize(tiles[message.tile_index].pixel_count());
+                        alive = read_all(c.fd, pixels.data(), pixels.size() * sizeof(colour));
+                        if (alive && finish_tile(c, message.tile_index, pixels, image, sample_end - sample_begin))
+                            progress.tile_done(c.slot, std::chrono::nanoseconds(message.busy_ns), message.work);
+                    }
+
+                    if (alive) {
+                        assign_tile(c, sample_begin, sample_end);
+                    } else {
+                        worker_died(f - 1);
+                    }
+                }
+
+                if (fds[0].revents & POLLIN) {
+                    int fd = accept(listen_fd, nullptr, nullptr);
+                    if (fd >= 0)
+                        connections.push_back(connection{fd, free_slot()});
+                }
+
+                // Idle workers get any tiles handed back by dead workers
+                for (auto& c : connections)
+                    if (c.idle && !pending.empty())
+                        send_tile(c, next_pending(), sample_begin, sample_end);
+
+                if (tiles_left > 0 && connections.empty() && reap_children() == 0 && !restart_worker()) {
+                    std::cerr << "ERROR::FARM:: All workers died, giving up" << std::endl;
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Adds a delivered tile to image. Returns false if another worker already delivered it.
+        bool finish_tile(connection& c, size_t index, const std::vector<colour>& pixels,
+                         framebuffer& image, int sample_count) {
+            bytes_received += pixels.size() * sizeof(colour);
+            tile_copies[index]--;
+            c.tile = -1;
+            if (tile_finished[index])
+                return false; // Another worker already delivered this (stolen) tile
+
+            const tile& t = tiles[index];
+            size_t p = 0;
+            for (int j = t.y0; j < t.y1; ++j)
+                for (int i = t.x0; i < t.x1; ++i)
+                    image.add(i, j, pixels[p++], sample_count);
+
+            tile_finished[index] = true;
+            tiles_left--;
+            return true;
+        }
+
+        long next_pending() {
+            while (!pending.empty()) {
+                auto index = pending.front();
+                pending.pop_front();
+                if (!tile_finished[index])
+                    return index;
+            }
+            return -1;
+        }
+
+        // Hands c its next tile. Leaves it idle if there is nothing to do (or steal).
+        void assign_tile(connection& c, int sample_begin, int sample_end) {
+            long index = next_pending();
+
+            if (index < 0) {
+                // Steal the longest running tile that nobody else is duplicating yet
+                const connection* victim = nullptr;
+                for (auto& other : connections) {
+                    if (other.tile < 0 || tile_copies[other.tile] > 1) continue;
+                    if (!victim || other.assigned_at < victim->assigned_at)
+                        victim = &other;
+                }
+                if (victim)
+                    index = victim->tile;
+            }
+
+            if (index >= 0)
+                send_tile(c, index, sample_begin, sample_end);
+            else
+                c.idle = true;
+        }
+
+        void send_tile(connection& c, long index, int sample_begin, int sample_end) {
+            if (index < 0) return;
+
+            farm_message message{};
+            message.type = farm_tile;
+            message.tile_index = index;
+            message.bounds = tiles[index];
+            message.sample_begin = sample_begin;
+            message.sample_end = sample_end;
+
+            c.tile = index;
+            c.idle = false;
+            c.assigned_at = std::chrono::steady_clock::now();
+            tile_copies[index]++;
+            // A failed write is picked up as a hang up by the next poll
+            write_all(c.fd, &message, sizeof(message));
+        }
+
+        void worker_died(size_t connection_index) {
+            auto& c = connections[connection_index];
+            if (c.tile >= 0) {
+                tile_copies[c.tile]--;
+                if (!tile_finished[c.tile] && tile_copies[c.tile] == 0)
+                    pending.push_front(c.tile);
+            }
+            close(c.fd);
+            connections.erase(connections.begin() + connection_index);
+
+            std::cerr << "\nFARM:: Worker disconnected";
+            if (tiles_left > 0 && restart_worker())
+                std::cerr << ", started a replacement";
+            std::cerr << std::endl;
+        }
+};
+
+#endif
@@ -0,0 +1,294 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "rtweekend.h"
+
+#include "aov.h"
+#include "colour.h"
+#include "exr.h"
+#include "pixel_filter.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/* Floating point accumulation image.
+   Holds the running sum of sample colours and the number of samples taken for every pixel,
+   so that images rendered separately (e.g. different sample ranges in different processes)
+   can be merged by simply adding them together. The final colour is sum / samples.
+   Images rendered with a splatting pixel filter (see pixel_filter.h) also keep the filter
+   weight sum of every pixel, and their final colour is sum / weight instead.
+   With enable_aovs, it also keeps first hit data for every pixel (albedo, normal, depth,
+   object id), written by write_aovs. Those are only written by the process that rendered
+   them: partial images and merge carry the colours alone. */
+class framebuffer {
+    public:
+        int width = 0;
+        int height = 0;
+        std::vector<colour> sum; // Sum of all sample colours for each pixel
+        std::vector<uint32_t> samples; // Number of samples accumulated for each pixel
+        std::vector<aov_sample> aovs; // First hit data for each pixel (empty unless enabled)
+        std::vector<double> weights; // Filter weight sum for each pixel (empty unless enabled)
+
+        framebuffer() {}
+        framebuffer(int width, int height)
+         : width(width), height(height), sum(width*height), samples(width*height, 0) {}
+
+        void add(int i, int j, const colour& c, uint32_t sample_count) {
+            auto index = j*width + i;
+            sum[index] += c;
+            samples[index] += sample_count;
+        }
+
+        // Counts samples whose colours are splatted (add_splats) rather than added here
+        void add_samples(int i, int j, uint32_t sample_count) {
+            samples[j*width + i] += sample_count;
+        }
+
+        // Starts keeping filter weights; any samples already in are box filtered (weight 1)
+        void enable_weights() {
+            if (weights.empty())
+                weights.assign(samples.begin(), samples.end());
+        }
+        bool has_weights() const { return !weights.empty(); }
+
+        // What the pixel's colour sum is divided by: its weight sum, or its sample count
+        double weight(size_t index) const {
+            return weights.empty() ? samples[index] : weights[index];
+        }
+
+        /* Adds a render thread's finished splat tile (the parts inside the image), which
+           needs weights enabled. Neighbouring tiles overlap at their aprons and can finish at
+           the same time, so each row goes in under a lock: one of a few shared by every
+           image, picked by the row, which is plenty for a handful of adds per tile. */
+        void add_splats(const splat_tile& t) {
+            static std::mutex row_locks[16];
+            for (int j = std::max(t.y0, 0); j < std::min(t.y0 + t.height, height); j++) {
+                std::lock_guard<std::mutex> lock(row_locks[j % 16]);
+                for (int i = std::max(t.x0, 0); i < std::min(t.x0 + t.width, width); i++) {
+                    auto from = static_cast<size_t>(j - t.y0) * t.width + (i - t.x0);
+                    auto index = static_cast<size_t>(j) * width + i;
+                    sum[index] += t.sum[from];
+                    weights[index] += t.weight[from];
+                }
+            }
+        }
+
+        void enable_aovs() { aovs.assign(width*height, aov_sample()); }
+        bool has_aovs() const { return !aovs.empty(); }
+
+        void add_aovs(int i, int j, const aov_sample& a) {
+            auto& pixel = aovs[j*width + i];
+            if (pixel.hits == 0)
+                pixel.object_id = a.object_id;
+            pixel.albedo += a.albedo;
+            pixel.normal += a.normal;
+            pixel.depth += a.depth;
+            pixel.samples += a.samples;
+            pixel.hits += a.hits;
+            pixel.view_dependent += a.view_dependent;
+        }
+
+        // Adds all the samples of other into this image. Returns false if the sizes differ.
+        bool merge(const framebuffer& other) {
+            if (other.width != width || other.height != height)
+                return false;
+
+            if (other.has_weights())
+                enable_weights();
+            for (size_t index = 0; index < sum.size(); index++) {
+                sum[index] += other.sum[index];
+                samples[index] += other.samples[index];
+                if (has_weights())
+                    weights[index] += other.weight(index);
+            }
+            return true;
+        }
+
+        // Average colour of pixel index (sum / samples, or sum / weight)
+        colour average(size_t index) const {
+            auto w = weight(index);
+            return w > 0 ? sum[index] / w : colour(0, 0, 0);
+        }
+
+        /* Root mean square error of the average (linear) pixel colours against reference,
+           over all pixels and channels. Returns -1 if the sizes differ.
+           With blur_sigma > 0 the error image is Gaussian blurred first, which roughly models
+           how the eye sees the image from a distance: fine grained (high frequency) error
+           mostly averages away, blotchy (low frequency) error does not. */
+        double rmse(const framebuffer& reference, double blur_sigma = 0) const {
+            if (reference.width != width || reference.height != height)
+                return -1;
+
+            std::vector<colour> error(sum.size());
+            for (size_t index = 0; index < sum.size(); index++)
+                error[index] = average(index) - reference.average(index);
+            if (blur_sigma > 0)
+                blur(error, blur_sigma);
+
+            double total = 0;
+            for (auto& e : error)
+                total += e.length_squared();
+            return sqrt(total / (3.0 * sum.size()));
+        }
+
+        // Writes the resolved (averaged and gamma corrected) image in PPM format
+        void write_ppm(std::ostream& out) const {
+            out << "P3\n" << width << ' ' << height << "\n255\n";
+            for (size_t index = 0; index < sum.size(); index++)
+                write_colour(out, average(index), 1);
+        }
+
+        /* Partial accumulation format:
+             RTACC 1\n<width> <height>\n
+           followed by the raw sums (3 doubles per pixel) and then the raw sample counts
+           (1 uint32 per pixel), both in host byte order. Filtered images are RTACC 2, with
+           the weight sums (1 double per pixel) after the counts. */
+        bool write_partial(std::ostream& out) const {
+            out << "RTACC " << (has_weights() ? 2 : 1) << '\n' << width << ' ' << height << '\n';
+            out.write(reinterpret_cast<const char*>(sum.data()), sum.size() * sizeof(colour));
+            out.write(reinterpret_cast<const char*>(samples.data()), samples.size() * sizeof(uint32_t));
+            if (has_weights())
+                out.write(reinterpret_cast<const char*>(weights.data()), weights.size() * sizeof(double));
+            return bool(out);
+        }
+
+        bool read_partial(std::istream& in) {
+            std::string magic;
+            int version;
+            in >> magic >> version >> width >> height;
+            if (!in || magic != "RTACC" || (version != 1 && version != 2) || width <= 0 || height <= 0)
+                return false;
+            in.get(); // Skip the newline before the binary data
+
+            sum.assign(width*height, colour());
+            samples.assign(width*height, 0);
+            in.read(reinterpret_cast<char*>(sum.data()), sum.size() * sizeof(colour));
+            in.read(reinterpret_cast<char*>(samples.data()), samples.size() * sizeof(uint32_t));
+            weights.clear();
+            if (version == 2) {
+                weights.resize(width*height);
+                in.read(reinterpret_cast<char*>(weights.data()), weights.size() * sizeof(double));
+            }
+            return bool(in);
+        }
+
+        bool load_partial(const std::string& path) {
+            std::ifstream file(path, std::ios::binary);
+            if (!file || !read_partial(file)) {
+                std::cerr << "ERROR::FRAMEBUFFER:: Could not read partial image " << path << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+        /* Writes the AOVs: into one multi-layer EXR (with the image) if path ends in .exr,
+           otherwise as separate images path_albedo.pfm, path_normal.pfm, path_depth.pfm,
+           path_samples.pfm (floats, for tools) and path_id.ppm (a colour per object).
+           Normals are averaged and normalised; pixels where nothing was hit have depth
+           infinity. Returns false if a file could not be written. */
+        bool write_aovs(const std::string& path) const {
+            auto size = static_cast<size_t>(width) * height;
+            std::vector<float> albedo(3*size), normal(3*size), depth(size), colour_sum(3*size), counts(size);
+            std::vector<uint32_t> ids(size), sample_counts(size);
+            for (size_t index = 0; index < size; index++) {
+                const auto& a = aovs[index];
+                auto n = a.hits > 0 ? unit_vector(a.normal) : vec3(0, 0, 0);
+                auto beauty = average(index);
+                for (int c = 0; c < 3; c++) {
+                    albedo[3*index + c] = static_cast<float>(samples[index] > 0 ? a.albedo[c] / samples[index] : 0);
+                    normal[3*index + c] = static_cast<float>(n[c]);
+                    colour_sum[3*index + c] = static_cast<float>(beauty[c]);
+                }
+                depth[index] = a.hits > 0 ? static_cast<float>(a.depth / a.hits) : std::numeric_limits<float>::infinity();
+                ids[index] = a.object_id;
+                sample_counts[index] = samples[index];
+                counts[index] = static_cast<float>(samples[index]);
+            }
+
+            if (path.size() > 4 && path.compare(path.size() - 4, 4, ".exr") == 0) {
+                exr_image exr(width, height);
+                const char* rgb[3] = {"R", "G", "B"};
+                const char* xyz[3] = {"X", "Y", "Z"};
+                for (int c = 0; c < 3; c++) {
+                    exr.add_channel(rgb[c], channel_of(colour_sum, c));
+                    exr.add_channel(std::string("albedo.") + rgb[c], channel_of(albedo, c));
+                    exr.add_channel(std::string("N.") + xyz[c], channel_of(normal, c));
+                }
+                exr.add_channel("Z", depth);
+                exr.add_channel("id", ids);
+                exr.add_channel("samples", sample_counts);
+                return exr.write(path);
+            }
+
+            bool written = write_pfm(path + "_albedo.pfm", albedo, 3) && write_pfm(path + "_normal.pfm", normal, 3)
+                        && write_pfm(path + "_depth.pfm", depth, 1) && write_pfm(path + "_samples.pfm", counts, 1);
+            std::ofstream id_file(path + "_id.ppm");
+            id_file << "P3\n" << width << ' ' << height << "\n255\n";
+            for (auto id : ids)
+                write_colour(id_file, id ? id_colour(id) : colour(0, 0, 0), 1);
+            if (!id_file) {
+                std::cerr << "ERROR::FRAMEBUFFER:: Could not write " << path << "_id.ppm" << std::endl;
+                return false;
+            }
+            return written;
+        }
+
+    private:
+        // One channel of an interleaved rgb image
+        std::vector<float> channel_of(const std::vector<float>& rgb, int c) const {
+            std::vector<float> values(rgb.size() / 3);
+            for (size_t index = 0; index < values.size(); index++)
+                values[index] = rgb[3*index + c];
+            return values;
+        }
+
+        /* Portable float map: a tiny raw float image format (PF for rgb, Pf for one
+           channel). Rows run bottom to top; the negative scale means little endian. */
+        bool write_pfm(const std::string& path, const std::vector<float>& values, int channels) const {
+            std::ofstream file(path, std::ios::binary);
+            file << (channels == 3 ? "PF" : "Pf") << '\n' << width << ' ' << height << "\n-1.0\n";
+            for (int j = height - 1; j >= 0; j--)
+                file.write(reinterpret_cast<const char*>(&values[static_cast<size_t>(j) * width * channels]),
+                           sizeof(float) * width * channels);
+            if (!file) {
+                std::cerr << "ERROR::FRAMEBUFFER:: Could not write " << path << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+        // Separable Gaussian blur of a width x height image, clamping at the edges
+        void blur(std::vector<colour>& pixels, double sigma) const {
+            int radius = static_cast<int>(ceil(3 * sigma));
+            std::vector<double> weights(2*radius + 1);
+            double weight_sum = 0;
+            for (int k = -radius; k <= radius; k++)
+                weight_sum += weights[k + radius] = exp(-k*k / (2 * sigma * sigma));
+            for (auto& w : weights)
+                w /= weight_sum;
+
+            std::vector<colour> temporary(pixels.size());
+            for (int j = 0; j < height; j++)
+                for (int i = 0; i < width; i++) {
+                    colour c(0, 0, 0);
+                    for (int k = -radius; k <= radius; k++)
+                        c += weights[k + radius] * pixels[j*width + std::clamp(i + k, 0, width - 1)];
+                    temporary[j*width + i] = c;
+                }
+            for (int j = 0; j < height; j++)
+                for (int i = 0; i < width; i++) {
+                    colour c(0, 0, 0);
+                    for (int k = -radius; k <= radius; k++)
+                        c += weights[k + radius] * temporary[std::clamp(j + k, 0, height - 1)*width + i];
+                    pixels[j*width + i] = c;
+                }
+        }
+};
+
+#endif
@@ -0,0 +1,306 @@
+#ifndef GUIDING_H
+#define GUIDING_H
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+#include "vec2.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <vector>
+
+/* Path guiding with a spatial-directional tree (Müller, Gross & Novák 2017, "Practical Path
+   Guiding for Efficient Light-Transport Simulation").
+
+   The render is done in passes of 1, 2, 4, 8... samples per pixel. Every diffuse bounce of
+   a pass records how much light came back along the direction it took into a guide: a
+   binary tree that splits the scene into boxes (the spatial tree), each with a quadtree
+   over the sphere of directions (the directional tree). Between passes every quadtree is
+   rebuilt to be finer where more light arrived, and boxes that got many records are split
+   in half. Later passes then send part of their bounce rays in proportion to the learned
+   incident light, which finds small bright things (light focused through glass, a lit patch
+   of wall) far more often than the bsdf alone does.
+
+   During a pass the trees are only read and added to. Additions are lock free atomic
+   compare and swap loops, so render threads never wait for each other. The trees are
+   rebuilt between passes, when no render threads are running. */
+
+// A double that threads can add to at the same time without locks. Copies take a snapshot.
+struct atomic_accumulator {
+    std::atomic<double> value{0};
+
+    atomic_accumulator() {}
+    atomic_accumulator(const atomic_accumulator& other) : value(other.get()) {}
+    atomic_accumulator& operator=(const atomic_accumulator& other) {
+        value.store(other.get(), std::memory_order_relaxed);
+        return *this;
+    }
+
+    void add(double amount) {
+        auto old = value.load(std::memory_order_relaxed);
+        while (!value.compare_exchange_weak(old, old + amount, std::memory_order_relaxed)) {}
+    }
+    double get() const { return value.load(std::memory_order_relaxed); }
+};
+
+/* Distribution of incident light over the sphere of directions, as a quadtree over the
+   unit square. Directions map to the square by cylindrical (equal area) coordinates,
+   x = (cos(theta) + 1) / 2 and y = phi / 2pi, so the solid angle pdf is the square's pdf
+   over 4pi. Each node covers a square split into four quadrants; a quadrant is either a
+   leaf or has a child node covering it. */
+class directional_tree {
+    public:
+        directional_tree() : nodes(1) {}
+
+        // False until a pass has recorded some light here (then it can't be sampled)
+        bool trained() const { return total > 0; }
+
+        // Picks a direction in proportion to the learned light, returning its solid angle pdf
+        vec3 sample(vec2 u, double& pdf) const {
+            double square_pdf = 1;
+            double x = 0, y = 0; // Corner of the current quadrant
+            double scale = 1;
+            int n = 0;
+            while (true) {
+                const auto& e = nodes[n].energy;
+                auto sum = e[0] + e[1] + e[2] + e[3];
+                // Choose the column, then the quadrant in it, reusing each part of u
+                auto p_right = (e[1] + e[3]) / sum;
+                int qx = u[0] >= 1 - p_right;
+                u[0] = qx ? (u[0] - (1 - p_right)) / p_right : u[0] / (1 - p_right);
+                auto column = qx ? e[1] + e[3] : e[0] + e[2];
+                auto p_bottom = e[2 + qx] / column;
+                int qy = u[1] >= 1 - p_bottom;
+                u[1] = qy ? (u[1] - (1 - p_bottom)) / p_bottom : u[1] / (1 - p_bottom);
+                u = vec2(fmin(u[0], 0.99999999999999989), fmin(u[1], 0.99999999999999989));
+
+                int q = qx + 2*qy;
+                square_pdf *= 4 * e[q] / sum;
+                scale *= 0.5;
+                x += qx * scale;
+                y += qy * scale;
+                if (nodes[n].child[q] < 0)
+                    break;
+                n = nodes[n].child[q];
+            }
+            pdf = square_pdf / (4 * pi);
+            return square_to_direction(vec2(x + scale * u[0], y + scale * u[1]));
+        }
+
+        // Solid angle pdf with which sample picks direction
+        double pdf(const vec3& direction) const {
+            if (!trained())
+                return 0;
+            auto p = direction_to_square(direction);
+            double square_pdf = 1;
+            int n = 0;
+            while (true) {
+                int q = quadrant(p);
+                const auto& e = nodes[n].energy;
+                square_pdf *= 4 * e[q] / (e[0] + e[1] + e[2] + e[3]);
+                if (nodes[n].child[q] < 0 || square_pdf <= 0)
+                    break;
+                n = nodes[n].child[q];
+            }
+            return square_pdf / (4 * pi);
+        }
+
+        // Adds an estimate of the light arriving along direction (radiance over pdf)
+        void record(const vec3& direction, double amount) {
+            auto p = direction_to_square(direction);
+            int n = 0;
+            while (true) {
+                int q = quadrant(p);
+                if (nodes[n].child[q] < 0) {
+                    nodes[n].recorded[q].add(amount);
+                    break;
+                }
+                n = nodes[n].child[q];
+            }
+            samples.add(1);
+        }
+
+        // Number of records since the last rebuild
+        double sample_count() const { return samples.get(); }
+
+        /* Rebuilds the tree from what was recorded since the last rebuild: quadrants holding
+           more than split_fraction of the total get their own node (down to max_depth), the
+           rest are merged into leaves. The recorded light becomes what sample picks from. */
+        void rebuild(double split_fraction = 0.01, int max_depth = 20) {
+            std::vector<std::array<double, 4>> sums(nodes.size());
+            subtree_sums(0, sums);
+            auto root = sums[0];
+            total = root[0] + root[1] + root[2] + root[3];
+
+            std::vector<node> rebuilt;
+            if (total > 0)
+                build(rebuilt, 0, root, 1, split_fraction * total, max_depth, sums);
+            else
+                rebuilt.emplace_back(); // Nothing arrived: untrained, one empty node
+            nodes.swap(rebuilt);
+            samples = atomic_accumulator();
+        }
+
+    private:
+        struct node {
+            int child[4] = {-1, -1, -1, -1}; // Node covering each quadrant, or -1 for a leaf
+            std::array<double, 4> energy = {0, 0, 0, 0}; // What sample picks from (last rebuild)
+            atomic_accumulator recorded[4]; // Added to during a pass (leaf quadrants only)
+        };
+
+        std::vector<node> nodes;
+        double total = 0; // Sum of the energies at the last rebuild
+        atomic_accumulator samples;
+
+        // Recorded light in each quadrant of node n, including its children's
+        void subtree_sums(int n, std::vector<std::array<double, 4>>& sums) const {
+            for (int q = 0; q < 4; q++) {
+                auto c = nodes[n].child[q];
+                if (c < 0) {
+                    sums[n][q] = nodes[n].recorded[q].get();
+                } else {
+                    subtree_sums(c, sums);
+                    sums[n][q] = sums[c][0] + sums[c][1] + sums[c][2] + sums[c][3];
+                }
+            }
+        }
+
+        // Adds a node with the given quadrant energies, matching node old of the previous tree
+        // (or -1 if that was a leaf there), and its children. Returns its index.
+        int build(std::vector<node>& rebuilt, int old, const std::array<double, 4>& energy, int depth,
+                  double split_energy, int max_depth, const std::vector<std::array<double, 4>>& sums) const {
+            int index = static_cast<int>(rebuilt.size());
+            rebuilt.emplace_back();
+            rebuilt[index].energy = energy;
+            if (depth >= max_depth)
+                return index;
+
+            for (int q = 0; q < 4; q++) {
+                if (energy[q] <= split_energy)
+                    continue;
+                // A leaf that gets split spreads its light evenly over its new quadrants
+                auto old_child = old >= 0 ? nodes[old].child[q] : -1;
+                std::array<double, 4> child_energy;
+                if (old_child >= 0)
+                    child_energy = sums[old_child];
+                else
+                    child_energy.fill(energy[q] / 4);
+                auto child = build(rebuilt, old_child, child_energy, depth + 1, split_energy, max_depth, sums);
+                rebuilt[index].child[q] = child;
+            }
+            return index;
+        }
+
+        // Quadrant of p in the current node, moving p into that quadrant's coordinates
+        static int quadrant(vec2& p) {
+            int qx = p[0] >= 0.5, qy = p[1] >= 0.5;
+            p = vec2(fmin(2 * p[0] - qx, 0.99999999999999989), fmin(2 * p[1] - qy, 0.99999999999999989));
+            return qx + 2*qy;
+        }
+
+        static vec2 direction_to_square(const vec3& direction) {
+            auto d = unit_vector(direction);
+            auto x = (std::clamp(d.z(), -1.0, 1.0) + 1) / 2;
+            auto y = atan2(d.y(), d.x()) / (2 * pi);
+            if (y < 0)
+                y += 1;
+            return vec2(fmin(x, 0.99999999999999989), fmin(y, 0.99999999999999989));
+        }
+
+        static vec3 square_to_direction(const vec2& p) {
+            auto cos_theta = 2 * p[0] - 1;
+            auto sin_theta = sqrt(fmax(0.0, 1 - cos_theta*cos_theta));
+            auto phi = 2 * pi * p[1];
+            return vec3(sin_theta * cos(phi), sin_theta * sin(phi), cos_theta);
+        }
+};
+
+// The spatial tree: boxes of the scene, each with its directional_tree
+class path_guide {
+    public:
+        bool recording = true; // Whether bounces record into the guide (off in the last pass)
+
+        path_guide(const aabb& bounds) : trees(1) {
+            nodes.push_back(spatial_node{bounds, {-1, -1}, 0});
+        }
+
+        // The directional tree of the box containing p
+        directional_tree& at(const point3& p) {
+            return trees[leaf(p)];
+        }
+        const directional_tree& at(const point3& p) const {
+            return trees[leaf(p)];
+        }
+
+        /* Between passes: rebuilds every directional tree from this pass's records, then
+           splits every box that got more than split_threshold records in half along its
+           longest side (again and again, halving the count each time), both halves starting
+           out with a copy of its directional tree. */
+        void refine(double split_threshold) {
+            std::vector<double> counts(trees.size());
+            for (size_t t = 0; t < trees.size(); t++) {
+                counts[t] = trees[t].sample_count();
+                trees[t].rebuild();
+            }
+
+            // Indices of nodes pushed during the loop are handled by the loop too
+            for (size_t n = 0; n < nodes.size(); n++) {
+                if (nodes[n].child[0] >= 0)
+                    continue;
+                auto t = nodes[n].tree;
+                if (counts[t] <= split_threshold)
+                    continue;
+
+                auto box = nodes[n].bounds;
+                int axis = box.longest_axis();
+                auto range = box.axis_interval(axis);
+                auto middle = 0.5 * (range.min + range.max);
+                aabb halves[2] = {box, box};
+                set_axis(halves[0], axis, interval(range.min, middle));
+                set_axis(halves[1], axis, interval(middle, range.max));
+
+                counts[t] /= 2;
+                auto copy = trees[t];
+                trees.push_back(copy);
+                counts.push_back(counts[t]);
+                int first = static_cast<int>(nodes.size());
+                nodes.push_back(spatial_node{halves[0], {-1, -1}, t});
+                nodes.push_back(spatial_node{halves[1], {-1, -1}, static_cast<int>(trees.size()) - 1});
+                nodes[n].child[0] = first;
+                nodes[n].child[1] = first + 1;
+                nodes[n].axis = axis;
+                nodes[n].split = middle;
+            }
+        }
+
+        size_t box_count() const { return trees.size(); }
+
+    private:
+        struct spatial_node {
+            aabb bounds;
+            int child[2]; // Lower and upper half along axis, or -1 for a leaf
+            int tree; // Index of the leaf's directional tree
+            int axis = 0;
+            double split = 0;
+        };
+
+        std::vector<spatial_node> nodes;
+        std::vector<directional_tree> trees;
+
+        int leaf(const point3& p) const {
+            int n = 0;
+            while (nodes[n].child[0] >= 0)
+                n = nodes[n].child[p[nodes[n].axis] < nodes[n].split ? 0 : 1];
+            return nodes[n].tree;
+        }
+
+        static void set_axis(aabb& box, int axis, const interval& range) {
+            if (axis == 0) box.x = range;
+            else if (axis == 1) box.y = range;
+            else box.z = range;
+        }
+};
+
+#endif
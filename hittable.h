@@ -7,6 +7,7 @@
 #include "aabb.h"
 
 class material;
+class hittable;
 
 struct hit_record {
     point3 p; // Point at which the ray has hit an object
@@ -16,6 +17,8 @@ struct hit_record {
     bool front_face; // True if ray is intersecting from "outside" of object. 
     //                  False if ray is intersecting from inside.
     vec2 uv; // UV coords (mapping determined by object type)
+    const hittable* object = nullptr; // The primitive (sphere, triangle) that was hit
+    const hittable* instance = nullptr; // The placed copy (see instance.h) the primitive was hit through, if any
 
     void set_face_normal(const ray& r, const vec3& outward_normal) {
         // Determine if ray is facing the inside or outside of the surface by
@@ -33,7 +36,24 @@ class hittable {
 
         virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
 
+        /* Any hit: true if r hits anything in ray_t. Shadow and occlusion rays only need to
+           know that, so acceleration structures override this to stop at the first hit found
+           (not the nearest), and primitives to skip filling in a hit record. */
+        virtual bool occluded(const ray& r, interval ray_t) const {
+            hit_record rec;
+            return hit(r, ray_t, rec);
+        }
+
         virtual aabb bounding_box() const = 0;
+
+        /* Light sampling, for shapes that can be emissive (see lights.h): the material of
+           the whole surface, its area, and a point picked uniformly by area from the 2D
+           sample u at the given time. Shapes that cannot be sampled return false. */
+        virtual const material* surface_material() const { return nullptr; }
+        virtual double surface_area() const { return 0; }
+        virtual bool sample_surface(const vec2& u, double time, point3& p, vec3& normal) const {
+            return false;
+        }
 };
 
 #endif
\ No newline at end of file
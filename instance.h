@@ -0,0 +1,124 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "transform.h"
+
+#include <memory>
+
+/* A placed copy of a shared object, usually a mesh in its own BVH (a bottom level
+   acceleration structure, BLAS). Rays are moved into the object's space, intersected with
+   the shared object there, and the hit is moved back. The transform maps object space to
+   world space; the ray direction goes through unnormalised, so t means the same in both.
+   Each copy costs the transform, a pointer and an optional material, whatever the size of
+   the object, so a scene can hold many copies of a big mesh. A copy can also move (motion
+   blur) between two transforms over the shutter interval.
+
+   lights.h and photon_map.h collect the scene's primitives, which instances hide, so
+   instanced meshes should not be emissive (their light would only be found by chance),
+   and glass or metal ones cast no photon map caustics. */
+class instance : public hittable {
+    public:
+        // mat, if given, replaces the object's own materials for this copy
+        instance(std::shared_ptr<const hittable> object, const affine_transform& to_world,
+                 std::shared_ptr<material> mat = nullptr)
+         : object(std::move(object)), mat(std::move(mat)) {
+            set_transform(to_world);
+        }
+
+        // A copy that moves from start to end over the shutter interval (ray times 0 to 1)
+        instance(std::shared_ptr<const hittable> object, const affine_transform& start,
+                 const affine_transform& end, std::shared_ptr<material> mat = nullptr)
+         : object(std::move(object)), mat(std::move(mat)) {
+            set_transform(start, end);
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            if (identity) {
+                // Left where it is (as static parts of a tlas are): nothing to transform
+                if (!object->hit(r, ray_t, rec))
+                    return false;
+                if (mat)
+                    rec.mat = mat;
+                return true;
+            }
+            if (!moving)
+                return hit(r, ray_t, rec, to_world);
+            return hit(r, ray_t, rec, affine_transform::interpolate(to_world, to_world_end, r.time()));
+        }
+
+        bool occluded(const ray& r, interval ray_t) const override {
+            if (identity)
+                return object->occluded(r, ray_t);
+            if (!moving)
+                return object->occluded(object_ray(r, to_world), ray_t);
+            return object->occluded(object_ray(r, affine_transform::interpolate(to_world, to_world_end, r.time())), ray_t);
+        }
+
+        aabb bounding_box() const override { return bbox; }
+
+        const affine_transform& transform() const { return to_world; }
+
+        /* Placing and moving the copy. These change the bounding box, so a BVH holding the
+           instance needs a refit (tlas.h does that), and must not be called during a render. */
+        void set_transform(const affine_transform& xf) {
+            to_world = to_world_end = xf;
+            moving = false;
+            identity = xf.is_identity();
+            bbox = to_world.box(object->bounding_box());
+        }
+
+        void set_transform(const affine_transform& start, const affine_transform& end) {
+            to_world = start;
+            to_world_end = end;
+            moving = true;
+            identity = false;
+            // Points move in straight lines between the two (see affine_transform::interpolate)
+            bbox = aabb(to_world.box(object->bounding_box()), to_world_end.box(object->bounding_box()));
+        }
+
+        // Swaps in another object, e.g. a rebuilt BLAS after the mesh was edited
+        void set_object(std::shared_ptr<const hittable> new_object) {
+            object = std::move(new_object);
+            if (moving)
+                set_transform(to_world, to_world_end);
+            else
+                set_transform(to_world);
+        }
+
+    private:
+        std::shared_ptr<const hittable> object;
+        affine_transform to_world; // At the start of the shutter interval
+        affine_transform to_world_end; // At the end, if moving
+        bool moving = false;
+        bool identity = false; // Not moving and at the identity transform
+        std::shared_ptr<material> mat;
+        aabb bbox;
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec, const affine_transform& xf) const {
+            if (!object->hit(object_ray(r, xf), ray_t, rec))
+                return false;
+            // The face side is kept: the normal mapping keeps the sign of dot(direction, normal)
+            rec.p = xf.point(rec.p);
+            rec.normal = unit_vector(xf.normal(rec.normal));
+            rec.instance = this;
+            if (mat)
+                rec.mat = mat;
+            return true;
+        }
+
+        static ray object_ray(const ray& r, const affine_transform& xf) {
+            return ray(xf.inverse_point(r.origin()), xf.inverse_vector(r.direction()), r.time());
+        }
+};
+
+// Builds a BLAS for instancing: a BVH over objects (e.g. the triangles of one mesh)
+inline std::shared_ptr<const hittable> make_blas(hittable_list objects) {
+    return std::make_shared<bvh_node>(objects);
+}
+
+#endif
@@ -0,0 +1,158 @@
+#ifndef INTERACTIVE_H
+#define INTERACTIVE_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "settings.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Interactive (look development) mode.
+   Keeps the scene in memory and reads camera changes from a stream (normally stdin), one
+   line of camera settings per change (see settings.h), e.g.
+     lookfrom=2,1,3 vfov=40
+     defocus_angle=0.5 focus_dist=3
+   Settings accumulate, so each line only needs what changed. "quit" (or end of input) exits.
+
+   Each change cancels the render in flight and starts again progressively: a tiny, one
+   sample image first (which arrives within milliseconds) and then larger and better ones.
+   Every level is written to <output_prefix>_<level>.ppm as soon as it is done; the files
+   are replaced atomically, so a viewer watching them never sees half an image.
+   The photon map (which does not depend on the camera) is built once before the first
+   preview, so levels only pay for their pixels. An irradiance cache is spaced in pixels of
+   the image it is made for, so it would have to start again at every level; it is not
+   supported here (see options.h). */
+
+struct progressive_level {
+    int divisor; // Image width (and height) is divided by this
+    int samples_per_pixel; // 0 uses the camera's samples_per_pixel
+};
+
+class interactive_renderer {
+    public:
+        std::string output_prefix = "preview";
+        std::vector<progressive_level> levels = {{8, 1}, {4, 1}, {2, 4}, {1, 0}};
+
+        // Runs until "quit" or the end of commands. Returns a process exit code.
+        int run(const hittable& world, const camera& initial, std::istream& commands) {
+            if (initial.sampler == sampler_type::blue_noise)
+                blue_noise_mask::get(); // Build the mask now rather than during the first preview
+
+            camera current = initial;
+            // Every camera from here on is a copy of current, sharing its photon map
+            current.build_photon_map(world);
+            submit(current);
+            std::thread renderer(&interactive_renderer::render_loop, this, std::cref(world));
+
+            std::string line;
+            while (std::getline(commands, line) && line != "quit") {
+                std::vector<setting> settings;
+                camera changed = current;
+                bool ok = parse_settings(line, settings);
+                for (auto& s : settings)
+                    ok = ok && apply_camera_setting(changed, s.first, s.second);
+
+                if (!ok) {
+                    std::cerr << "Ignoring bad camera command '" << line << "'" << std::endl;
+                    continue;
+                }
+                if (settings.empty())
+                    continue;
+
+                current = changed;
+                submit(current);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                quit = true;
+                cancel = true;
+            }
+            wake.notify_one();
+            renderer.join();
+            return 0;
+        }
+
+    private:
+        using clock = std::chrono::steady_clock;
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        camera pending; // Camera to render next (guarded by mutex)
+        bool has_pending = false;
+        bool quit = false;
+        clock::time_point command_time; // When the pending camera arrived
+        std::atomic<bool> cancel{false}; // Set to stop the render in flight
+
+        // Hands a new camera to the render thread, cancelling whatever it is doing
+        void submit(const camera& cam) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                pending = cam;
+                has_pending = true;
+                command_time = clock::now();
+                cancel = true;
+            }
+            wake.notify_one();
+        }
+
+        void render_loop(const hittable& world) {
+            while (true) {
+                camera cam;
+                clock::time_point started;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait(lock, [this] { return has_pending || quit; });
+                    if (quit)
+                        return;
+                    cam = pending;
+                    started = command_time;
+                    has_pending = false;
+                    cancel = false;
+                }
+
+                for (size_t l = 0; l < levels.size(); l++) {
+                    camera level_cam = cam;
+                    level_cam.image_width = std::max(1, cam.image_width / levels[l].divisor);
+                    if (levels[l].samples_per_pixel > 0)
+                        level_cam.samples_per_pixel = std::min(levels[l].samples_per_pixel, cam.samples_per_pixel);
+                    level_cam.cancel = &cancel;
+                    level_cam.show_progress = false;
+
+                    framebuffer image;
+                    if (!level_cam.render(world, image, 0, level_cam.samples_per_pixel))
+                        break; // A newer camera arrived
+
+                    write_level(l, image);
+                    auto latency = std::chrono::duration<double, std::milli>(clock::now() - started).count();
+                    std::cerr << "Level " << l << " (" << image.width << "x" << image.height << ", "
+                              << level_cam.samples_per_pixel << " spp) ready " << latency << "ms after command" << std::endl;
+                }
+            }
+        }
+
+        void write_level(size_t level, const framebuffer& image) const {
+            auto path = output_prefix + "_" + std::to_string(level) + ".ppm";
+            auto temporary = path + ".tmp";
+            {
+                std::ofstream file(temporary);
+                image.write_ppm(file);
+            }
+            std::rename(temporary.c_str(), path.c_str());
+        }
+};
+
+#endif
@@ -0,0 +1,263 @@
+#ifndef IRRADIANCE_CACHE_H
+#define IRRADIANCE_CACHE_H
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+#include "colour.h"
+#include "onb.h"
+
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+/* Irradiance cache (Ward, Rubinstein & Clear 1988; gradients from Ward & Heckbert 1992).
+   Light bouncing between diffuse surfaces changes slowly over a surface, so instead of
+   path tracing it at every pixel it is computed carefully (a hundred or more hemisphere rays)
+   at scattered record points and interpolated in between.
+
+   Each record stores the irradiance at its point, how it changes as the point moves and as
+   the normal turns (its translational and rotational gradients, which come for free from
+   the same hemisphere rays), and the harmonic mean distance R to the surfaces it saw. A
+   record is used at points within a * R of it with similar normals; nearby geometry makes R
+   small, so records crowd into corners and spread out over open surfaces. R is also kept
+   below E / |translational gradient|, so a record is not stretched over a place where its
+   irradiance would change by more than itself, and between min_spacing and max_spacing
+   pixels (as seen from the camera).
+
+   Records live in an octree over the scene, each in the node whose size matches its
+   radius of use. Lookups share a reader lock; a new record takes the writer lock just long
+   enough to be inserted, so any thread can add records while the others keep reading. */
+class irradiance_cache {
+    public:
+        // Defaults are set for previews; Ward's own (a = 0.1 to 0.2, normal weight 1, a few
+        // hundred rays per record) are smoother but need several times as many records
+        double accuracy = 0.4; // Ward's a: records are used out to a * R (smaller is finer)
+        double normal_weight = 0.5; // Weight of the normal difference in the error estimate
+        double min_spacing = 4; // Radius of use limits, in pixels
+        double max_spacing = 20;
+        int theta_strata = 6; // Hemisphere rays per record: theta_strata x phi_strata
+        int phi_strata = 18;
+
+        irradiance_cache(const aabb& bounds) {
+            // A cube around the scene, so the octree's nodes are cubes too
+            auto size = fmax(bounds.x.size(), fmax(bounds.y.size(), bounds.z.size()));
+            point3 centre(0.5*(bounds.x.min + bounds.x.max), 0.5*(bounds.y.min + bounds.y.max),
+                          0.5*(bounds.z.min + bounds.z.max));
+            root_min = centre - vec3(size, size, size) * 0.5;
+            root_size = size;
+            nodes.emplace_back();
+        }
+
+        /* Interpolated irradiance at p (normal n) from the records near it. Returns false if
+           no record is close enough (then add one with create). */
+        bool lookup(const point3& p, const vec3& n, colour& irradiance) const {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            colour sum(0, 0, 0);
+            double weight_sum = 0;
+            lookup_node(0, root_min, root_size, p, n, sum, weight_sum);
+            if (weight_sum <= 0)
+                return false;
+            irradiance = sum / weight_sum;
+            return true;
+        }
+
+        /* Computes a record at p (normal n) and adds it. trace(direction, distance) returns
+           the light arriving at p from direction and sets distance to the nearest surface
+           that way (infinity if none). pixel_size is the width a pixel covers at p.
+           Returns the record's irradiance. */
+        colour create(const point3& p, const vec3& n, double pixel_size,
+                      const std::function<colour(const vec3&, double&)>& trace) {
+            record rec;
+            rec.p = p;
+            rec.n = n;
+            sample_hemisphere(rec, trace);
+
+            // Radius of use: a * R, limited by the gradient and the pixel spacing limits
+            auto gradient = luminance(rec.translational);
+            auto e = luminance(rec.irradiance);
+            if (gradient > 0 && e > 0)
+                rec.radius = fmin(rec.radius, e / gradient);
+            rec.radius = std::clamp(accuracy * rec.radius, min_spacing * pixel_size, max_spacing * pixel_size);
+
+            std::unique_lock<std::shared_mutex> lock(mutex);
+            insert(rec);
+            return rec.irradiance;
+        }
+
+        size_t size() const {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            return record_count;
+        }
+
+    private:
+        struct record {
+            point3 p;
+            vec3 n;
+            colour irradiance;
+            vec3 rotational[3]; // Gradient of each channel as the normal turns
+            vec3 translational[3]; // Gradient of each channel as the point moves
+            double radius = infinity; // Radius of use (harmonic mean distance until limited)
+        };
+
+        struct node {
+            std::vector<record> records;
+            int children[8] = {-1, -1, -1, -1, -1, -1, -1, -1};
+        };
+
+        mutable std::shared_mutex mutex;
+        std::vector<node> nodes;
+        point3 root_min;
+        double root_size;
+        size_t record_count = 0;
+
+        static double luminance(const colour& c) {
+            return 0.2126*c.x() + 0.7152*c.y() + 0.0722*c.z();
+        }
+        static double luminance(const vec3 gradient[3]) {
+            return (0.2126*gradient[0] + 0.7152*gradient[1] + 0.0722*gradient[2]).length();
+        }
+
+        /* Cosine weighted, stratified hemisphere rays: M rings of equal projected solid angle
+           (sin^2 theta steps by 1/M) times N sectors, one jittered ray per cell. Besides the
+           irradiance, the differences between neighbouring cells give the gradients. */
+        void sample_hemisphere(record& rec, const std::function<colour(const vec3&, double&)>& trace) const {
+            int m = theta_strata, n = phi_strata;
+            std::vector<colour> radiance(m * n);
+            std::vector<double> distance(m * n);
+            std::vector<double> tan_theta(m * n), phi(m * n);
+            onb uvw(rec.n);
+
+            double inverse_distance_sum = 0;
+            colour sum(0, 0, 0);
+            for (int j = 0; j < m; j++) {
+                for (int k = 0; k < n; k++) {
+                    auto sin2 = (j + random_double()) / m;
+                    auto cos_theta = sqrt(1 - sin2), sin_theta = sqrt(sin2);
+                    auto cell = j * n + k;
+                    phi[cell] = 2 * pi * (k + random_double()) / n;
+                    tan_theta[cell] = sin_theta / fmax(cos_theta, 1e-6);
+                    auto direction = uvw.local(vec3(sin_theta * cos(phi[cell]), sin_theta * sin(phi[cell]), cos_theta));
+                    radiance[cell] = trace(direction, distance[cell]);
+                    sum += radiance[cell];
+                    inverse_distance_sum += 1 / distance[cell];
+                }
+            }
+            rec.irradiance = sum * (pi / (m * n));
+            rec.radius = inverse_distance_sum > 0 ? m * n / inverse_distance_sum : infinity;
+
+            for (int c = 0; c < 3; c++) {
+                rec.rotational[c] = vec3(0, 0, 0);
+                rec.translational[c] = vec3(0, 0, 0);
+            }
+            for (int k = 0; k < n; k++) {
+                auto previous_k = (k + n - 1) % n;
+                auto centre_phi = 2 * pi * (k + 0.5) / n;
+                auto edge_phi = 2 * pi * k / n;
+                auto u_k = cos(centre_phi) * uvw.u() + sin(centre_phi) * uvw.v(); // Towards sector k
+                auto v_edge = -sin(edge_phi) * uvw.u() + cos(edge_phi) * uvw.v(); // Across its first edge
+
+                for (int j = 0; j < m; j++) {
+                    auto cell = j * n + k;
+                    auto v_k = -sin(phi[cell]) * uvw.u() + cos(phi[cell]) * uvw.v();
+                    auto sin_minus = sqrt(double(j) / m), sin_plus = sqrt(double(j + 1) / m);
+                    auto cos2_minus = 1 - double(j) / m;
+
+                    for (int c = 0; c < 3; c++) {
+                        rec.rotational[c] += v_k * (-tan_theta[cell] * radiance[cell][c]);
+
+                        // Change across the ring boundary below cell (j, k)
+                        if (j > 0) {
+                            auto below = (j - 1) * n + k;
+                            auto r = fmin(distance[cell], distance[below]);
+                            rec.translational[c] += u_k * ((2 * pi / n) * sin_minus * cos2_minus / r
+                                                           * (radiance[cell][c] - radiance[below][c]));
+                        }
+                        // Change across the sector boundary before cell (j, k)
+                        auto before = j * n + previous_k;
+                        auto r = fmin(distance[cell], distance[before]);
+                        rec.translational[c] += v_edge * ((sin_plus - sin_minus) / r
+                                                          * (radiance[cell][c] - radiance[before][c]));
+                    }
+                }
+            }
+            for (int c = 0; c < 3; c++)
+                rec.rotational[c] = rec.rotational[c] * (pi / (m * n));
+        }
+
+        // Adds the weighted, extrapolated irradiance of the records usable at p from node index
+        // (a cube at corner with side size) and its children
+        void lookup_node(int index, const point3& corner, double size, const point3& p, const vec3& n,
+                         colour& sum, double& weight_sum) const {
+            const auto& nd = nodes[index];
+            for (const auto& rec : nd.records) {
+                auto offset = p - rec.p;
+                auto distance = offset.length();
+                if (distance >= rec.radius)
+                    continue;
+                auto normal_term = normal_weight * sqrt(fmax(0.0, 1 - dot(n, rec.n)));
+                // The radius of use is a * R, so the error estimate is d / R = a * d / radius
+                auto error = accuracy * distance / rec.radius + normal_term;
+                if (error >= accuracy)
+                    continue;
+                // Skip records in front of p (p is in a crease the record could not see)
+                if (dot(offset, n + rec.n) < -0.1 * rec.radius)
+                    continue;
+
+                auto weight = 1 / fmax(error, 1e-9) - 1 / accuracy;
+                auto turn = cross(rec.n, n);
+                colour e;
+                for (int c = 0; c < 3; c++)
+                    e[c] = fmax(0.0, rec.irradiance[c] + dot(turn, rec.rotational[c]) + dot(offset, rec.translational[c]));
+                sum += weight * e;
+                weight_sum += weight;
+            }
+
+            auto half = size / 2;
+            for (int octant = 0; octant < 8; octant++) {
+                if (nd.children[octant] < 0)
+                    continue;
+                auto child_corner = corner + half * octant_offset(octant);
+                // A child's records reach at most half its size outside it
+                if (inside_expanded(p, child_corner, half, half / 2))
+                    lookup_node(nd.children[octant], child_corner, half, p, n, sum, weight_sum);
+            }
+        }
+
+        // Stores rec in the smallest node containing its point that is at least twice its
+        // radius of use across
+        void insert(const record& rec) {
+            int index = 0;
+            point3 corner = root_min;
+            double size = root_size;
+            while (size / 2 >= 2 * rec.radius) {
+                int octant = 0;
+                for (int axis = 0; axis < 3; axis++)
+                    if (rec.p[axis] >= corner[axis] + size / 2)
+                        octant |= 1 << axis;
+                size /= 2;
+                corner = corner + size * octant_offset(octant);
+                if (nodes[index].children[octant] < 0) {
+                    nodes[index].children[octant] = static_cast<int>(nodes.size());
+                    nodes.emplace_back();
+                }
+                index = nodes[index].children[octant];
+            }
+            nodes[index].records.push_back(rec);
+            record_count++;
+        }
+
+        static vec3 octant_offset(int octant) {
+            return vec3(octant & 1, (octant >> 1) & 1, (octant >> 2) & 1);
+        }
+
+        static bool inside_expanded(const point3& p, const point3& corner, double size, double margin) {
+            for (int axis = 0; axis < 3; axis++)
+                if (p[axis] < corner[axis] - margin || p[axis] > corner[axis] + size + margin)
+                    return false;
+            return true;
+        }
+};
+
+#endif
@@ -0,0 +1,145 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+/* Emitters of a scene, for next event estimation (sampling a light directly from each
+   diffuse bounce and testing it with a shadow ray).
+
+   With many lights, most of them barely light any given point, so picking one uniformly
+   wastes most shadow rays. The lights are kept in a light BVH instead: every node stores
+   the bounds and total power of the lights below it, and a light is picked by walking
+   down from the root, choosing each child in proportion to its power over its squared
+   distance from the shading point. Nearby and bright lights get picked more often, and
+   the walk only costs O(log n) per pick. (Conty & Kulla 2018, "Importance Sampling of Many
+   Lights with Adaptive Tree Splitting", without the orientation cones) */
+
+struct emitter {
+    std::shared_ptr<hittable> shape;
+    const material* mat; // The shape's material, which has a non zero emission
+    double area;
+    double power; // Emitted power (up to a constant): luminance of the emission times area
+    aabb bounds;
+};
+
+class light_tree {
+    public:
+        // Collects every shape in objects with a diffuse_light material
+        light_tree(const hittable_list& objects) {
+            for (const auto& object : objects.objects) {
+                auto light = dynamic_cast<const diffuse_light*>(object->surface_material());
+                if (!light || object->surface_area() <= 0)
+                    continue;
+                auto e = light->emission();
+                auto luminance = 0.2126*e.x() + 0.7152*e.y() + 0.0722*e.z();
+                if (luminance <= 0)
+                    continue;
+                auto area = object->surface_area();
+                lights.push_back(emitter{object, light, area, luminance * area, object->bounding_box()});
+            }
+
+            if (!lights.empty()) {
+                std::vector<size_t> order(lights.size());
+                for (size_t i = 0; i < order.size(); i++)
+                    order[i] = i;
+                build(order, 0, order.size());
+            }
+        }
+
+        bool empty() const { return lights.empty(); }
+        size_t size() const { return lights.size(); }
+        const emitter& operator[](size_t i) const { return lights[i]; }
+
+        /* Picks a light to sample from point p, using the 1D sample u. Returns the index of
+           the light and the probability it had of being picked. */
+        size_t pick(const point3& p, double u, double& probability) const {
+            probability = 1;
+            int n = 0; // Root
+            while (nodes[n].light < 0) {
+                auto left = importance(nodes[nodes[n].left], p);
+                auto right = importance(nodes[nodes[n].right], p);
+                auto p_left = left + right > 0 ? left / (left + right) : 0.5;
+
+                // Reuse u for the next level by stretching the part of it that was chosen
+                if (u < p_left) {
+                    u = u / p_left;
+                    probability *= p_left;
+                    n = nodes[n].left;
+                } else {
+                    u = (u - p_left) / (1 - p_left);
+                    probability *= 1 - p_left;
+                    n = nodes[n].right;
+                }
+                u = fmin(u, 0.99999999999999989); // Guard against rounding up to 1
+            }
+            return nodes[n].light;
+        }
+
+    private:
+        struct node {
+            aabb bounds;
+            double power = 0;
+            int left = -1, right = -1; // Child nodes (interior nodes only)
+            int light = -1; // Light index (leaves only)
+        };
+
+        std::vector<emitter> lights;
+        std::vector<node> nodes;
+
+        // Builds the subtree of lights order[begin, end). Returns the index of its root node.
+        int build(std::vector<size_t>& order, size_t begin, size_t end) {
+            int index = static_cast<int>(nodes.size());
+            nodes.emplace_back();
+
+            if (end - begin == 1) {
+                nodes[index].bounds = lights[order[begin]].bounds;
+                nodes[index].power = lights[order[begin]].power;
+                nodes[index].light = static_cast<int>(order[begin]);
+                return index;
+            }
+
+            // Split at the median centroid along the longest axis of the centroids
+            aabb centroids = aabb::empty;
+            for (size_t i = begin; i < end; i++) {
+                auto c = centre(lights[order[i]].bounds);
+                centroids = aabb(centroids, aabb(c, c));
+            }
+            int axis = centroids.longest_axis();
+            auto mid = begin + (end - begin) / 2;
+            std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+                             [&](size_t a, size_t b) {
+                                 return centre(lights[a].bounds)[axis] < centre(lights[b].bounds)[axis];
+                             });
+
+            auto left = build(order, begin, mid);
+            auto right = build(order, mid, end);
+            nodes[index].left = left;
+            nodes[index].right = right;
+            nodes[index].bounds = aabb(nodes[left].bounds, nodes[right].bounds);
+            nodes[index].power = nodes[left].power + nodes[right].power;
+            return index;
+        }
+
+        static point3 centre(const aabb& box) {
+            return point3(0.5*(box.x.min + box.x.max), 0.5*(box.y.min + box.y.max), 0.5*(box.z.min + box.z.max));
+        }
+
+        // Estimated light reaching p from the lights under n
+        static double importance(const node& n, const point3& p) {
+            auto half_diagonal = 0.5 * vec3(n.bounds.x.size(), n.bounds.y.size(), n.bounds.z.size()).length();
+            // Don't let points inside (or very close to) the bounds blow up the estimate
+            auto distance_squared = fmax((centre(n.bounds) - p).length_squared(), half_diagonal*half_diagonal);
+            return n.power / fmax(distance_squared, 1e-12);
+        }
+};
+
+#endif
@@ -1,177 +1,226 @@
 #include "rtweekend.h"
 
-#include "bvh.h"
+#include "batch.h"
 #include "camera.h"
 #include "colour.h"
+#include "daemon.h"
+#include "denoise.h"
+#include "environment.h"
+#include "farm.h"
 #include "hittable_list.h"
-#include "material.h"
-#include "sphere.h"
-#include "triangle.h"
+#include "interactive.h"
+#include "options.h"
+#include "scenes.h"
+#include "sequence.h"
+#include "tlas.h"
 
 #include <chrono>
+#include <fstream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Sets up cam (on top of the scene's own settings) with the render options from the command line
+void apply_render_options(const render_options& options, camera& cam) {
+    if (options.samples_per_pixel > 0)
+        cam.samples_per_pixel = options.samples_per_pixel;
+    cam.threads = options.threads;
+    cam.sampler = options.sampler;
+    cam.light_sampling = options.light_sampling;
+    cam.guiding = options.guiding;
+    cam.caustic_photons = options.caustic_photons;
+    cam.irradiance_caching = options.irradiance_cache;
+    cam.diffuse_splits = options.primary_splits[0];
+    cam.glossy_splits = options.primary_splits[1];
+    cam.specular_splits = options.primary_splits[2];
+    cam.integrator = options.integrator;
+    cam.ao_rays = options.ao_rays;
+    cam.ao_distance = options.ao_distance;
+    cam.filter = pixel_filter(options.filter, options.filter_radius);
+}
+
+// Batch renders the cameras listed in path (see batch.h). Returns an exit code.
+int render_camera_list(const std::string& path, const hittable& world, const camera& defaults) {
+    std::vector<batch_camera> batch;
+    if (!load_camera_list(path, defaults, batch))
+        return 1;
+
+    std::vector<framebuffer> images;
+    auto render_start_time = std::chrono::steady_clock::now();
+    render_batch(world, batch, images, defaults.thread_count());
+    auto render_finish_time = std::chrono::steady_clock::now();
+    auto render_duration = std::chrono::duration_cast<std::chrono::milliseconds>(render_finish_time - render_start_time).count();
+    std::cerr << "Rendered " << batch.size() << " cameras in " << render_duration << "ms" << std::endl;
+
+    for (size_t c = 0; c < batch.size(); c++) {
+        std::ofstream file(batch[c].output);
+        images[c].write_ppm(file);
+        if (!file) {
+            std::cerr << "ERROR::BATCH:: Could not write " << batch[c].output << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Renders the scene as an animation (see sequence.h). objects are the scene's objects and
+// meshes the groups of them that can move. Returns an exit code.
+int render_animation(const render_options& options, const hittable_list& objects,
+                     const std::vector<hittable_list>& meshes, camera& cam) {
+    keyframed_transform motion;
+    if (!options.keyframes.empty()) {
+        if (!motion.load(options.keyframes))
+            return 1;
+        if (meshes.empty()) {
+            std::cerr << "ERROR::ANIMATION:: The scene has no meshes to animate" << std::endl;
+            return 1;
+        }
+        if (motion.last_mesh() >= static_cast<int>(meshes.size())) {
+            std::cerr << "ERROR::ANIMATION:: Keyframes for mesh " << motion.last_mesh() << ", but the scene has "
+                      << meshes.size() << " meshes" << std::endl;
+            return 1;
+        }
+    }
+
+    // Two level BVH: every mesh gets a BLAS of its own, so that moving it only moves its
+    // instance, and the objects outside any mesh share one more
+    tlas scene;
+    std::vector<animated_mesh> animated;
+    std::unordered_set<const hittable*> in_mesh, moving;
+    for (size_t m = 0; m < meshes.size(); m++) {
+        auto id = scene.add(make_blas(meshes[m]));
+        auto track = motion.track(static_cast<int>(m));
+        for (const auto& object : meshes[m].objects)
+            in_mesh.insert(object.get());
+        if (track.keys.empty())
+            continue;
+        animated.emplace_back(id, track, meshes[m]);
+        for (const auto& object : meshes[m].objects)
+            moving.insert(object.get());
+    }
+    hittable_list others, still_surfaces;
+    for (const auto& object : objects.objects) {
+        if (!in_mesh.count(object.get()))
+            others.add(object);
+        if (!moving.count(object.get()))
+            still_surfaces.add(object);
+    }
+    if (!others.objects.empty())
+        scene.add(make_blas(others));
+
+    camera_path flight;
+    if (!options.camera_path.empty() && !flight.load(options.camera_path))
+        return 1;
+
+    apply_render_options(options, cam);
+
+    sequence_renderer sequence;
+    sequence.frames = options.frames;
+    sequence.fps = options.fps;
+    sequence.shutter = options.shutter;
+    sequence.camera_motion = options.camera_path.empty() ? nullptr : &flight;
+    sequence.reuse_samples = options.temporal_reuse;
+    return sequence.render(scene, animated, still_surfaces, cam) ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+    render_options options;
+    if (!parse_options(argc, argv, options))
+        return 1;
 
-void load_final_scene(hittable_list& world, camera& cam);
-void load_final_scene_motion_blur(hittable_list& world, camera& cam);
+    if (!options.submit_socket.empty())
+        return submit_daemon_job(options.submit_socket, options.submit_job);
+
+    if (!options.daemon_socket.empty()) {
+        render_daemon daemon;
+        daemon.socket_path = options.daemon_socket;
+        daemon.threads = options.threads;
+        return daemon.run();
+    }
 
-int main() {
     hittable_list world;
     camera cam;
-    auto material_normal = std::make_shared<shade_normal>();
-    //auto material_ground = std::make_shared<lambertian>(colour(0.8, 0.8, 0.0));
-    //auto material_center = std::make_shared<lambertian>(colour(0.1, 0.2, 0.5));
-    //auto material_left   = std::make_shared<dielectric>(1.50);
-    //auto material_bubble = std::make_shared<dielectric>(1.00 / 1.50);
-    //auto material_right  = std::make_shared<metal>(colour(0.8, 0.6, 0.2), 0.0);
-
-    //world.add(std::make_shared<sphere>(point3( 0.0, -100.5, -1.0), 100.0, material_ground));
-    //world.add(std::make_shared<sphere>(point3( -1.5,    0.0, 0.5),   0.5, material_center));
-    //world.add(std::make_shared<sphere>(point3(0.0, 1.0, 0.0),   0.5, material_center));
-    //world.add(std::make_shared<sphere>(point3( 0.0,    0.0, -1.2),   0.4, material_bubble));
-    //world.add(std::make_shared<sphere>(point3( 2.0, 0.0, 0.5),   0.5, material_right));
-    //world.add(std::make_shared<sphere>(point3( 0.0, 0.0, 3.0),   0.5, material_right));
-
-    Model model = Model("./test_objects/suzanne.obj");
-    mesh_to_hittables(model, world, material_normal, vec3(0.0, 0.0, 0.0));
-    world = hittable_list(std::make_shared<bvh_node>(world));
+
+    if (!options.environment.empty()) {
+        auto environment = std::make_shared<environment_map>();
+        if (!environment->load(options.environment))
+            return 1;
+        cam.environment = environment;
+    }
+
+    if (options.frames > 0) {
+        std::vector<hittable_list> meshes;
+        if (!load_scene_objects(options.scene, world, cam, &meshes))
+            return 1;
+        return render_animation(options, world, meshes, cam);
+    }
+
+    if (!load_scene(options.scene, world, cam))
+        return 1;
 
     std::cerr << "World Size: " << world.objects.size() << std::endl;
 
-    cam.aspect_ratio      = 16.0 / 9.0;
-    cam.image_width       = 400;
-    cam.samples_per_pixel = 32;
-    cam.max_depth         = 50;
+    apply_render_options(options, cam);
+    cam.aovs = !options.aov_output.empty() || options.denoise;
 
-    cam.vfov     = 90;
-    cam.lookfrom = point3(0,0,1.5);
-    cam.lookat   = point3(0,0,1);
-    cam.vup      = vec3(0,1,0);
+    if (options.farm_worker)
+        return run_farm_worker(options.farm_socket, world, cam);
 
-    cam.defocus_angle = 0.0;
-    cam.focus_dist    = 1.0;
+    if (!options.camera_list.empty())
+        return render_camera_list(options.camera_list, world, cam);
 
-    //load_final_scene_motion_blur(world, cam);
-    //cam.image_width = 400;
-    //cam.samples_per_pixel = 32;
+    if (options.interactive) {
+        interactive_renderer interactive;
+        return interactive.run(world, cam, std::cin);
+    }
 
+    int sample_begin = options.sample_range ? options.sample_begin : 0;
+    int sample_end = options.sample_range ? options.sample_end : cam.samples_per_pixel;
+    framebuffer image;
 
     auto render_start_time = std::chrono::steady_clock::now();
-    cam.render(world);
+    if (options.farm_workers > 0) {
+        tile_farm farm;
+        farm.workers = options.farm_workers;
+        farm.socket_path = options.farm_socket;
+        if (!farm.render(world, cam, image, sample_begin, sample_end))
+            return 1;
+    } else {
+        cam.render(world, image, sample_begin, sample_end);
+    }
     auto render_finish_time = std::chrono::steady_clock::now();
     auto render_duration = std::chrono::duration_cast<std::chrono::milliseconds>(render_finish_time - render_start_time).count();
     std::cerr << "Render time: " << render_duration << "ms" << std::endl;
-}
 
-void load_final_scene(hittable_list& world, camera& cam)
-{
-    cam.aspect_ratio      = 16.0 / 9.0;
-    cam.image_width       = 1200;
-    cam.samples_per_pixel = 500;
-    cam.max_depth         = 50;
-
-    cam.vfov     = 20;
-    cam.lookfrom = point3(13,2,3);
-    cam.lookat   = point3(0,0,0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0.6;
-    cam.focus_dist    = 10.0;
-
-    auto ground_material = std::make_shared<lambertian>(colour(0.5, 0.5, 0.5));
-    world.add(std::make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
-
-    for (int a = -11; a < 11; a++) {
-        for (int b = -11; b < 11; b++) {
-            auto choose_mat = random_double();
-            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
-
-            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
-                std::shared_ptr<material> sphere_material;
-
-                if (choose_mat < 0.8) {
-                    // diffuse
-                    auto albedo = colour::random() * colour::random();
-                    sphere_material = std::make_shared<lambertian>(albedo);
-                    world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
-                } else if (choose_mat < 0.95) {
-                    // metal
-                    auto albedo = colour::random(0.5, 1);
-                    auto fuzz = random_double(0, 0.5);
-                    sphere_material = std::make_shared<metal>(albedo, fuzz);
-                    world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
-                } else {
-                    // glass
-                    sphere_material = std::make_shared<dielectric>(1.5);
-                    world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
-                }
-            }
+    if (options.denoise) {
+        auto denoise_start_time = std::chrono::steady_clock::now();
+        atrous_denoiser denoiser;
+        if (!denoiser.run(image, cam.thread_count())) {
+            std::cerr << "ERROR::MAIN:: Nothing to denoise with (the render has no AOVs)" << std::endl;
+            return 1;
         }
+        auto denoise_duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - denoise_start_time).count();
+        std::cerr << "Denoise time: " << denoise_duration << "ms" << std::endl;
     }
 
-    auto material1 = std::make_shared<dielectric>(1.5);
-    world.add(std::make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-
-    auto material2 = std::make_shared<lambertian>(colour(0.4, 0.2, 0.1));
-    world.add(std::make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
-
-    auto material3 = std::make_shared<metal>(colour(0.7, 0.6, 0.5), 0.0);
-    world.add(std::make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-}
-
-void load_final_scene_motion_blur(hittable_list& world, camera& cam)
-{
-    cam.aspect_ratio      = 16.0 / 9.0;
-    cam.image_width       = 1200;
-    cam.samples_per_pixel = 500;
-    cam.max_depth         = 50;
-
-    cam.vfov     = 20;
-    cam.lookfrom = point3(13,2,3);
-    cam.lookat   = point3(0,0,0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0.6;
-    cam.focus_dist    = 10.0;
-
-    auto ground_material = std::make_shared<lambertian>(colour(0.5, 0.5, 0.5));
-    world.add(std::make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
-
-    for (int a = -11; a < 11; a++) {
-        for (int b = -11; b < 11; b++) {
-            auto choose_mat = random_double();
-            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
-
-            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
-                std::shared_ptr<material> sphere_material;
-
-                if (choose_mat < 0.8) {
-                    // diffuse
-                    auto albedo = colour::random() * colour::random();
-                    sphere_material = std::make_shared<lambertian>(albedo);
-                    auto center2 = center + vec3(0, random_double(0,.5), 0);
-                    world.add(std::make_shared<sphere>(center, center2, 0.2, sphere_material));
-                } else if (choose_mat < 0.95) {
-                    // metal
-                    auto albedo = colour::random(0.5, 1);
-                    auto fuzz = random_double(0, 0.5);
-                    sphere_material = std::make_shared<metal>(albedo, fuzz);
-                    world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
-                } else {
-                    // glass
-                    sphere_material = std::make_shared<dielectric>(1.5);
-                    world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
-                }
-            }
-        }
+    if (!options.reference.empty()) {
+        framebuffer reference;
+        if (!reference.load_partial(options.reference))
+            return 1;
+        std::cerr << "RMSE against " << options.reference << ": " << image.rmse(reference)
+                  << " (blurred: " << image.rmse(reference, 1.0) << ")" << std::endl;
     }
 
-    auto material1 = std::make_shared<dielectric>(1.5);
-    world.add(std::make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-
-    auto material2 = std::make_shared<lambertian>(colour(0.4, 0.2, 0.1));
-    world.add(std::make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
-
-    auto material3 = std::make_shared<metal>(colour(0.7, 0.6, 0.5), 0.0);
-    world.add(std::make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+    if (!options.aov_output.empty()) {
+        if (!image.has_aovs())
+            std::cerr << "ERROR::MAIN:: No AOVs to write (farm renders only return colours)" << std::endl;
+        else if (!image.write_aovs(options.aov_output))
+            return 1;
+    }
 
-    world = hittable_list(std::make_shared<bvh_node>(world));
+    if (options.sample_range)
+        image.write_partial(std::cout);
+    else
+        image.write_ppm(std::cout);
 }
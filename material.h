@@ -3,39 +3,110 @@
 
 #include "rtweekend.h"
 
-class hit_record;
+#include "hittable.h"
+#include "onb.h"
+#include "sampler.h"
+
+/* The result of sampling a material.
+   For non specular scattering, bsdf and pdf describe the sampled direction, so the
+   integrator weights the scattered light by bsdf * cos(theta) / pdf, and can combine the
+   sample with others (e.g. light samples) through eval and pdf.
+   Specular scattering (a perfect mirror or glass, or anything else eval and pdf cannot
+   describe) is a single direction instead: the light is just weighted by attenuation. */
+struct scatter_record {
+    ray scattered;
+    bool specular = false;
+    colour attenuation; // Weight of a specular sample
+    colour bsdf; // BSDF value (without the cosine) for the scattered direction
+    double pdf = 0; // Solid angle pdf of the scattered direction
+};
+
+// How a material scatters, for settings that differ between kinds of surface
+enum class material_class {
+    diffuse, // Scatters over the hemisphere (eval and pdf describe it)
+    glossy, // Random directions around a specular one (fuzzed metal)
+    specular, // A single direction, or a random pick between a few (mirror, glass)
+    emissive // Only gives off light
+};
 
 class material {
     public:
+        /* Materials are numbered from 1 in the order they are made. load_scene_objects
+           starts the count again for each scene, and builds scenes the same way every time,
+           so a material gets the same id in every run and every render process (which its
+           address does not). */
+        const uint32_t id = next_id()++;
+
         virtual ~material() = default; // Virtual Destructor
 
+        // Numbers the materials made from here on from 1 again
+        static void restart_ids() { next_id() = 1; }
+
         /* Virtual function inherited materials need to define.
-           Has 3 functions:
-              1. Given an incident ray (ray_in), return if the ray was absorbed, or produce a scattered ray.
-              2. If the scattered ray is produced, how is the colour attenuated.
+           Given an incident ray (ray_in), return false if the ray was absorbed, otherwise
+           sample a scattered ray and fill in how it is weighted (see scatter_record).
         */
-        virtual bool scatter(
-            const ray& r_in, const hit_record& rec, colour& attenuation, ray& scattered) const = 0;
+        virtual bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const = 0;
+
+        /* BSDF value for light arriving from direction and leaving along -r_in.direction().
+           Zero for specular materials, which only scatter into single directions. */
+        virtual colour eval(const ray& r_in, const hit_record& rec, const vec3& direction) const {
+            return colour(0, 0, 0);
+        }
+
+        // Solid angle pdf with which scatter would have picked direction (0 for specular)
+        virtual double pdf(const ray& r_in, const hit_record& rec, const vec3& direction) const {
+            return 0;
+        }
+
+        // Light given off at the hit point towards the origin of r_in
+        virtual colour emitted(const ray& r_in, const hit_record& rec) const {
+            return colour(0, 0, 0);
+        }
+
+        // True if scatter always gives specular samples (objects that can cast caustics)
+        virtual bool is_specular() const { return false; }
+
+        virtual material_class kind() const { return material_class::diffuse; }
+
+        // Share of light the surface reflects at rec, by colour (for the albedo AOV)
+        virtual colour surface_albedo(const hit_record& rec) const { return colour(1, 1, 1); }
+
+    private:
+        static uint32_t& next_id() {
+            static uint32_t next = 1;
+            return next;
+        }
 };
 
 class lambertian : public material {
     public:
         lambertian(const colour& _albedo) : albedo(_albedo) {}
 
-        bool scatter(const ray& r_in, const hit_record& rec, colour& attenuation, ray& scattered)
+        bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec)
         const override {
-            auto scatter_direction = rec.normal + random_unit_vector();
+            // Cosine weighted around the normal, which cancels the cosine term
+            onb uvw(rec.normal);
+            auto scatter_direction = uvw.local(sample_cosine_hemisphere());
+
+            srec.scattered = ray(rec.p, scatter_direction, r_in.time());
+            srec.specular = false;
+            srec.bsdf = eval(r_in, rec, scatter_direction);
+            srec.pdf = pdf(r_in, rec, scatter_direction);
+            return srec.pdf > 0;
+        }
 
-            // If the randomly generated ray is almost (or exactly) opposite the normal, avoid
-            // generating a zero ray (as this will never terminate)
-            if (scatter_direction.near_zero())
-                scatter_direction = rec.normal;
+        colour eval(const ray& r_in, const hit_record& rec, const vec3& direction) const override {
+            return dot(direction, rec.normal) > 0 ? albedo / pi : colour(0, 0, 0);
+        }
 
-            scattered = ray(rec.p, scatter_direction, r_in.time());
-            attenuation = albedo;
-            return true;
+        double pdf(const ray& r_in, const hit_record& rec, const vec3& direction) const override {
+            auto cosine = dot(unit_vector(direction), rec.normal);
+            return cosine > 0 ? cosine / pi : 0;
         }
 
+        colour surface_albedo(const hit_record& rec) const override { return albedo; }
+
     private:
         colour albedo;
 };
@@ -44,16 +115,27 @@ class metal : public material {
     public:
         metal(const colour& _albedo, double f) : albedo(_albedo), fuzz(f < 1 ? f : 1) {}
 
-        bool scatter(const ray& r_in, const hit_record& rec, colour& attenuation, ray& scattered)
+        /* Treated as specular even when fuzzed: the fuzz sphere has no simple pdf, so
+           eval and pdf are left at zero and the sample is weighted by the albedo. */
+        bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec)
         const override {
             auto reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-            scattered = ray(rec.p, reflected + fuzz*random_unit_vector(), r_in.time());
-            attenuation = albedo;
+            srec.scattered = ray(rec.p, reflected + fuzz*sample_unit_vector(), r_in.time());
+            srec.specular = true;
+            srec.attenuation = albedo;
 
             // Return false (ray is absorbed) if fuzzed ray is pointing back into the object 
-            return (dot(scattered.direction(), rec.normal) > 0);
+            return (dot(srec.scattered.direction(), rec.normal) > 0);
         }
 
+        bool is_specular() const override { return true; }
+
+        material_class kind() const override {
+            return fuzz > 0 ? material_class::glossy : material_class::specular;
+        }
+
+        colour surface_albedo(const hit_record& rec) const override { return albedo; }
+
     private:
         colour albedo;
         double fuzz;
@@ -63,9 +145,10 @@ class dielectric : public material {
     public:
         dielectric(double index_of_refraction) : ir(index_of_refraction) {}
 
-    bool scatter(const ray& r_in, const hit_record& rec, colour& attenuation, ray& scattered)
+    bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec)
         const override {
-            attenuation = colour(1.0, 1.0, 1.0);
+            srec.specular = true;
+            srec.attenuation = colour(1.0, 1.0, 1.0);
             // Refraction ratio is 1/ir if ray is going from air into material,
             // ir/1 if ray is travelling from material into air.
             double refraction_ratio = rec.front_face ? (1.0/ir) : ir;
@@ -80,18 +163,22 @@ class dielectric : public material {
             bool cannot_refract = refraction_ratio*sin_theta > 1.0;
             vec3 direction;
 
-            if (cannot_refract || reflectance(cos_theta, refraction_ratio) > random_double()) {
+            if (cannot_refract || reflectance(cos_theta, refraction_ratio) > sample_1d()) {
                 // Rays that cannot refract are reflected internally
                 direction = reflect(unit_direction, rec.normal);
             } else {
                 direction = refract(unit_direction, rec.normal, refraction_ratio);
             }
 
-            scattered = ray(rec.p, direction, r_in.time());
+            srec.scattered = ray(rec.p, direction, r_in.time());
 
             return true;
         }
 
+        bool is_specular() const override { return true; }
+
+        material_class kind() const override { return material_class::specular; }
+
     private:
         double ir; // Index of refraction
 
@@ -103,16 +190,44 @@ class dielectric : public material {
         }
 };
 
+/* Light source. Emits from the front face only (the side the outward normal points to) and
+   absorbs everything that hits it. */
+class diffuse_light : public material {
+    public:
+        diffuse_light(const colour& emit) : emit(emit) {}
+
+        bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec)
+        const override {
+            return false;
+        }
+
+        colour emitted(const ray& r_in, const hit_record& rec) const override {
+            return rec.front_face ? emit : colour(0, 0, 0);
+        }
+
+        const colour& emission() const { return emit; }
+
+        material_class kind() const override { return material_class::emissive; }
+
+    private:
+        colour emit;
+};
+
 class shade_normal : public material {
     public:
         shade_normal() {}
 
-    bool scatter(const ray& r_in, const hit_record& rec, colour& attenuation, ray& scattered)
+    bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec)
         const override {
-            scattered = ray(rec.p, rec.normal, r_in.time());
-            attenuation = colour(rec.normal);
+            srec.scattered = ray(rec.p, rec.normal, r_in.time());
+            srec.specular = true;
+            srec.attenuation = colour(rec.normal);
             return true;
         }
+
+        bool is_specular() const override { return true; }
+
+        material_class kind() const override { return material_class::specular; }
 };
 
 #endif
\ No newline at end of file
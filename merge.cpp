@@ -0,0 +1,53 @@
+#include "framebuffer.h"
+
+#include <iostream>
+#include <string>
+
+/* Merges partial accumulation images written by ./main --sample-range a..b
+   into the final image, written as PPM to stdout. With --reference, also prints the
+   RMSE of the merged image against another partial (e.g. a single-process render).
+   Usage: ./merge [--reference single.acc] part0.acc part1.acc ... > image.ppm
+*/
+int main(int argc, char* argv[]) {
+    int first = 1;
+    std::string reference;
+    if (argc > 2 && std::string(argv[1]) == "--reference") {
+        reference = argv[2];
+        first = 3;
+    }
+
+    if (argc <= first) {
+        std::cerr << "Usage: " << argv[0] << " [--reference partial] partial... > image.ppm" << std::endl;
+        return 1;
+    }
+
+    framebuffer image;
+    if (!image.load_partial(argv[first]))
+        return 1;
+
+    for (int a = first + 1; a < argc; a++) {
+        framebuffer partial;
+        if (!partial.load_partial(argv[a]))
+            return 1;
+        if (!image.merge(partial)) {
+            std::cerr << "ERROR::MERGE:: " << argv[a] << " is " << partial.width << "x" << partial.height
+                      << ", expected " << image.width << "x" << image.height << std::endl;
+            return 1;
+        }
+    }
+
+    if (!reference.empty()) {
+        framebuffer single;
+        if (!single.load_partial(reference))
+            return 1;
+        double error = image.rmse(single);
+        if (error < 0) {
+            std::cerr << "ERROR::MERGE:: " << reference << " is " << single.width << "x" << single.height
+                      << ", expected " << image.width << "x" << image.height << std::endl;
+            return 1;
+        }
+        std::cerr << "RMSE against " << reference << ": " << error << std::endl;
+    }
+
+    image.write_ppm(std::cout);
+}
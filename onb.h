@@ -0,0 +1,31 @@
+#ifndef ONB_H
+#define ONB_H
+
+#include "rtweekend.h"
+
+/* Orthonormal basis around a direction w, used to turn directions sampled around +z (local
+   space) into world space directions around w. */
+class onb {
+    public:
+        onb(const vec3& n) {
+            axis[2] = unit_vector(n);
+            // Any vector not parallel to w will do to start the basis
+            vec3 a = (fabs(axis[2].x()) > 0.9) ? vec3(0, 1, 0) : vec3(1, 0, 0);
+            axis[1] = unit_vector(cross(axis[2], a));
+            axis[0] = cross(axis[2], axis[1]);
+        }
+
+        const vec3& u() const { return axis[0]; }
+        const vec3& v() const { return axis[1]; }
+        const vec3& w() const { return axis[2]; }
+
+        // Local (u, v, w) coordinates to world space
+        vec3 local(const vec3& a) const {
+            return a[0]*axis[0] + a[1]*axis[1] + a[2]*axis[2];
+        }
+
+    private:
+        vec3 axis[3];
+};
+
+#endif
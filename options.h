@@ -0,0 +1,302 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include "aov.h"
+#include "pixel_filter.h"
+#include "sampler.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+/* Command line options for main.
+   Usage:
+     ./main                          Full render, PPM image to stdout
+     ./main --scene name             Scene to render: "final", "final_motion_blur",
+                                     "many_lights", "teapots" or the path of a model file
+                                     (see scenes.h)
+     ./main --spp n                  Override the scene's samples per pixel
+     ./main --sample-range a..b      Render samples [a, b) of every pixel and write a
+                                     partial accumulation image (see framebuffer.h) to
+                                     stdout instead. Combine partials with ./merge.
+     ./main --sampler type           Sample generator: independent (default), sobol,
+                                     stratified or blue_noise (see sampler.h)
+     ./main --reference path         After rendering, print the RMSE against the partial
+                                     image at path (e.g. a high spp --sample-range render),
+                                     plain and after blurring the error (perceived error)
+     ./main --environment path       Light the scene with an equirectangular HDR image
+                                     instead of the sky (see environment.h)
+     ./main --no-light-sampling      Only find lights and the environment by chance hits
+                                     (see lights.h)
+     ./main --guiding                Learn where light comes from while rendering, in
+                                     passes, and aim bounces there (see guiding.h)
+     ./main --caustic-photons n      Trace n photons before rendering and take caustics
+                                     from their density (see photon_map.h)
+     ./main --irradiance-cache       Fast preview of mostly diffuse scenes: interpolate
+                                     the light bounced between diffuse surfaces from
+                                     sparse records (see irradiance_cache.h)
+     ./main --primary-splits d,g,s   Trace one camera ray per sample and d, g or s paths
+                                     from its first hit when that is diffuse, glossy
+                                     (fuzzed metal) or specular (mirror, glass), e.g. 1,4,2
+                                     (see camera.h split_sample)
+     ./main --integrator type        What to render: path (default), ao (ambient
+                                     occlusion), normals, depth, primitive_id or
+                                     material_id. All but path look only at first hits
+                                     and are much faster (see aov.h)
+     ./main --ao-rays n              Occlusion rays per sample for ao (default 16)
+     ./main --ao-distance d          Only geometry within d occludes, for ao (default: any)
+     ./main --aovs path              Also write albedo, normal, depth, object id and sample
+                                     count images from the same render: one multi-layer
+                                     EXR if path ends in .exr, otherwise path_albedo.pfm,
+                                     path_normal.pfm... (see framebuffer.h write_aovs)
+     ./main --denoise                Denoise the image guided by its albedo, normal and
+                                     depth (see denoise.h)
+     ./main --filter type            Pixel filter: box (default), gaussian, mitchell or
+                                     blackman_harris (see pixel_filter.h)
+     ./main --filter-radius r        Filter radius in pixels (default: the filter's own,
+                                     at most 4)
+     ./main --threads n              Number of render threads (default: all cores)
+     ./main --cameras path           Render every camera in the list at path against the
+                                     one scene, writing an image per camera (see batch.h)
+     ./main --frames n --keyframes path
+                                     Render an animation of n frames (frame0000.ppm...),
+                                     moving the scene's meshes along the keyframes in
+                                     path (see animation.h, sequence.h, tlas.h)
+     ./main --frames n --camera-path path
+                                     Fly the camera along the keyframes in path instead of
+                                     (or as well as) moving the meshes
+     ./main --temporal-reuse         Reuse each frame's samples in the next where they are
+                                     still valid (camera paths of static scenes only, see
+                                     reprojection.h)
+     ./main --fps f                  Frame rate of the animation (default 24)
+     ./main --shutter s              Share of each frame the shutter is open for, 0 to 1:
+                                     the keyframed meshes blur over it (default 0)
+     ./main --interactive            Read camera changes from stdin and re-render
+                                     progressively to preview_<level>.ppm (see interactive.h)
+     ./main --farm n                 Render with n forked worker processes (see farm.h)
+     ./main --farm-socket path       Unix socket used by the farm
+     ./main --farm-worker path       Join the farm listening on path as an extra worker
+     ./main --daemon path            Run a render daemon on the socket path (see daemon.h)
+     ./main --submit path job        Send a job line to the daemon on path, print the reply
+*/
+struct render_options {
+    std::string scene = "./test_objects/suzanne.obj";
+    int samples_per_pixel = 0; // Overrides the scene's samples per pixel if > 0
+    bool sample_range = false; // True if only a range of samples should be rendered
+    int sample_begin = 0;
+    int sample_end = 0;
+
+    sampler_type sampler = sampler_type::independent;
+    std::string reference; // Partial image to compare the render against, if not empty
+    bool light_sampling = true;
+    bool guiding = false;
+    size_t caustic_photons = 0; // Photon map caustics if > 0
+    bool irradiance_cache = false;
+    int primary_splits[3] = {1, 1, 1}; // Paths per camera ray at diffuse, glossy and specular first hits
+    integrator_type integrator = integrator_type::path;
+    int ao_rays = 16;
+    double ao_distance = infinity;
+    std::string aov_output; // Where to write the AOVs, if not empty
+    bool denoise = false;
+    filter_type filter = filter_type::box;
+    double filter_radius = 0; // 0 uses the filter's default radius
+    std::string environment; // Environment map image, if not empty
+
+    int threads = 0; // Render threads (0 uses one per hardware thread)
+    std::string camera_list; // Batch render the cameras in this file if not empty
+    bool interactive = false; // Re-render on camera commands from stdin
+    int frames = 0; // Render an animation of this many frames if > 0
+    std::string keyframes; // Keyframes of the animation
+    std::string camera_path; // Keyframes of the camera, if not empty
+    bool temporal_reuse = false;
+    double fps = 24;
+    double shutter = 0; // Motion blur of keyframed meshes, as a share of the frame interval
+    int farm_workers = 0; // Render with this many worker processes if > 0
+    std::string farm_socket = "/tmp/rtweekend_farm.sock";
+    bool farm_worker = false; // True if this process should join a farm as a worker
+
+    std::string daemon_socket; // Run as a render daemon on this socket if not empty
+    std::string submit_socket; // Send submit_job to the daemon on this socket if not empty
+    std::string submit_job;
+};
+
+// Parses "a..b" into [begin, end). Returns false if the range is malformed or empty.
+inline bool parse_range(const std::string& text, int& begin, int& end) {
+    auto dots = text.find("..");
+    if (dots == std::string::npos)
+        return false;
+
+    char* rest;
+    begin = std::strtol(text.c_str(), &rest, 10);
+    if (rest != text.c_str() + dots)
+        return false;
+    end = std::strtol(text.c_str() + dots + 2, &rest, 10);
+    if (*rest != '\0')
+        return false;
+
+    return 0 <= begin && begin < end;
+}
+
+// Parses "d,g,s" into three counts of at least 1. Returns false if malformed.
+inline bool parse_splits(const std::string& text, int splits[3]) {
+    const char* p = text.c_str();
+    for (int k = 0; k < 3; k++) {
+        char* rest;
+        splits[k] = std::strtol(p, &rest, 10);
+        if (rest == p || splits[k] < 1 || *rest != (k < 2 ? ',' : '\0'))
+            return false;
+        p = rest + 1;
+    }
+    return true;
+}
+
+// Returns false (after printing the problem) if the arguments could not be parsed.
+inline bool parse_options(int argc, char* argv[], render_options& options) {
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        bool has_value = a + 1 < argc;
+
+        if (arg == "--scene" && has_value) {
+            options.scene = argv[++a];
+        } else if (arg == "--spp" && has_value) {
+            options.samples_per_pixel = std::atoi(argv[++a]);
+        } else if (arg == "--sample-range" && has_value) {
+            options.sample_range = true;
+            if (!parse_range(argv[++a], options.sample_begin, options.sample_end)) {
+                std::cerr << "Invalid sample range '" << argv[a] << "' (expected a..b with a < b)\n";
+                return false;
+            }
+        } else if (arg == "--sampler" && has_value) {
+            if (!parse_sampler_type(argv[++a], options.sampler)) {
+                std::cerr << "Unknown sampler '" << argv[a] << "'\n";
+                return false;
+            }
+        } else if (arg == "--reference" && has_value) {
+            options.reference = argv[++a];
+        } else if (arg == "--environment" && has_value) {
+            options.environment = argv[++a];
+        } else if (arg == "--no-light-sampling") {
+            options.light_sampling = false;
+        } else if (arg == "--guiding") {
+            options.guiding = true;
+        } else if (arg == "--caustic-photons" && has_value) {
+            options.caustic_photons = std::strtoull(argv[++a], nullptr, 10);
+        } else if (arg == "--irradiance-cache") {
+            options.irradiance_cache = true;
+        } else if (arg == "--primary-splits" && has_value) {
+            if (!parse_splits(argv[++a], options.primary_splits)) {
+                std::cerr << "Invalid split counts '" << argv[a] << "' (expected d,g,s, each at least 1)\n";
+                return false;
+            }
+        } else if (arg == "--integrator" && has_value) {
+            if (!parse_integrator_type(argv[++a], options.integrator)) {
+                std::cerr << "Unknown integrator '" << argv[a] << "' (expected path, ao, normals, depth, "
+                          << "primitive_id or material_id)\n";
+                return false;
+            }
+        } else if (arg == "--ao-rays" && has_value) {
+            options.ao_rays = std::atoi(argv[++a]);
+        } else if (arg == "--ao-distance" && has_value) {
+            options.ao_distance = std::atof(argv[++a]);
+        } else if (arg == "--aovs" && has_value) {
+            options.aov_output = argv[++a];
+        } else if (arg == "--denoise") {
+            options.denoise = true;
+        } else if (arg == "--filter" && has_value) {
+            if (!parse_filter_type(argv[++a], options.filter)) {
+                std::cerr << "Unknown filter '" << argv[a] << "' (expected box, gaussian, mitchell or blackman_harris)\n";
+                return false;
+            }
+        } else if (arg == "--filter-radius" && has_value) {
+            options.filter_radius = std::atof(argv[++a]);
+            if (options.filter_radius <= 0 || options.filter_radius > 4) {
+                std::cerr << "The filter radius must be more than 0 and at most 4\n";
+                return false;
+            }
+        } else if (arg == "--threads" && has_value) {
+            options.threads = std::atoi(argv[++a]);
+        } else if (arg == "--cameras" && has_value) {
+            options.camera_list = argv[++a];
+        } else if (arg == "--interactive") {
+            options.interactive = true;
+        } else if (arg == "--frames" && has_value) {
+            options.frames = std::atoi(argv[++a]);
+        } else if (arg == "--keyframes" && has_value) {
+            options.keyframes = argv[++a];
+        } else if (arg == "--camera-path" && has_value) {
+            options.camera_path = argv[++a];
+        } else if (arg == "--temporal-reuse") {
+            options.temporal_reuse = true;
+        } else if (arg == "--fps" && has_value) {
+            options.fps = std::atof(argv[++a]);
+        } else if (arg == "--shutter" && has_value) {
+            options.shutter = std::atof(argv[++a]);
+        } else if (arg == "--farm" && has_value) {
+            options.farm_workers = std::atoi(argv[++a]);
+        } else if (arg == "--farm-socket" && has_value) {
+            options.farm_socket = argv[++a];
+        } else if (arg == "--farm-worker" && has_value) {
+            options.farm_worker = true;
+            options.farm_socket = argv[++a];
+        } else if (arg == "--daemon" && has_value) {
+            options.daemon_socket = argv[++a];
+        } else if (arg == "--submit" && a + 2 < argc) {
+            options.submit_socket = argv[++a];
+            options.submit_job = argv[++a];
+        } else {
+            std::cerr << "Unknown or incomplete option '" << arg << "'\n";
+            return false;
+        }
+    }
+
+    if (options.frames > 0 && options.keyframes.empty() && options.camera_path.empty()) {
+        std::cerr << "--frames needs --keyframes or --camera-path\n";
+        return false;
+    }
+    if (options.shutter < 0 || options.shutter > 1) {
+        std::cerr << "--shutter must be between 0 and 1\n";
+        return false;
+    }
+    // Farm workers only render pixels: the caches camera::prepare builds before a render,
+    // and the AOVs, are not made or sent back
+    if ((options.farm_workers > 0 || options.farm_worker)
+        && (options.caustic_photons > 0 || options.irradiance_cache || options.guiding || !options.aov_output.empty())) {
+        std::cerr << "--caustic-photons, --irradiance-cache, --guiding and --aovs do not work with farm workers\n";
+        return false;
+    }
+    if (!options.camera_list.empty() && (options.guiding || !options.aov_output.empty() || options.denoise)) {
+        std::cerr << "--guiding, --aovs and --denoise do not work with --cameras\n";
+        return false;
+    }
+    if (options.filter != filter_type::box && options.farm_workers > 0) {
+        std::cerr << "--filter needs the samples themselves, which farm workers do not send (use --sample-range and merge)\n";
+        return false;
+    }
+    // Denoised partials would no longer add up, so only whole renders are denoised
+    if (options.denoise && options.sample_range) {
+        std::cerr << "--denoise needs the whole render, not a sample range\n";
+        return false;
+    }
+    if (options.denoise && options.farm_workers > 0) {
+        std::cerr << "--denoise needs the AOVs, which farm workers do not send\n";
+        return false;
+    }
+    if (options.temporal_reuse && (options.camera_path.empty() || !options.keyframes.empty())) {
+        std::cerr << "--temporal-reuse needs --camera-path, and a scene that does not move (no --keyframes)\n";
+        return false;
+    }
+    // Previews restart at every level, and an irradiance cache made for one level's pixels
+    // does not fit the next
+    if (options.interactive && options.irradiance_cache) {
+        std::cerr << "--irradiance-cache does not work with --interactive\n";
+        return false;
+    }
+    // Reused frames are rendered in two passes around the reprojection, neither of them guided
+    if (options.temporal_reuse && options.guiding) {
+        std::cerr << "--guiding does not work with --temporal-reuse\n";
+        return false;
+    }
+    return true;
+}
+
+#endif
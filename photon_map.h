@@ -0,0 +1,409 @@
+#ifndef PHOTON_MAP_H
+#define PHOTON_MAP_H
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+#include "environment.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "lights.h"
+#include "material.h"
+#include "sampler.h"
+#include "tile.h"
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/* Caustic photon map (Jensen 1996).
+   Caustics are light that reaches a diffuse surface through glass or off a mirror. A path
+   traced from the camera can only find them by bouncing off the diffuse surface, through
+   the glass and into a light by chance, which for small lights (or a sun) almost never
+   happens, so they stay as scattered bright speckles for a very long time.
+
+   Instead, before rendering, photons are traced the other way: out of the lights and in
+   from the environment, aimed at the bounding spheres of the specular objects (a light
+   picks a sphere in proportion to the solid angle it covers, the environment in proportion
+   to its cross section), so hardly any are wasted. Those that land on a diffuse surface
+   after one or more specular bounces are stored, in a kd-tree. At every diffuse hit the
+   renderer then estimates the caustic light there from the density of the nearest photons,
+   and stops counting the same light when its own paths find it (see camera.h).
+
+   Photons are traced in parallel chunks, each with its own random numbers, and the kd-tree
+   is built in parallel by handing the two halves of the top few levels to separate
+   threads. Lookups only read the tree. */
+
+struct photon {
+    point3 p;
+    vec3 direction; // Unit direction the photon was travelling when it landed
+    colour power;
+    int axis = 0; // Axis the kd-tree splits on at this photon
+};
+
+class photon_map {
+    public:
+        int gather_count = 50; // Photons per density estimate
+        double max_radius = 0; // Largest gather radius (0 picks one from the scene size)
+
+        // Collects the bounding spheres of the specular objects (caustic casters) among objects
+        photon_map(const hittable_list& objects) {
+            aabb all = aabb::empty;
+            for (const auto& object : objects.objects) {
+                auto mat = object->surface_material();
+                if (!mat || !mat->is_specular())
+                    continue;
+                auto box = object->bounding_box();
+                targets.push_back(target{centre(box), 0.5 * diagonal(box)});
+                all = aabb(all, box);
+            }
+            // Aiming costs a test against every target, so many small ones (e.g. the
+            // triangles of a glass mesh) are aimed at as one
+            if (targets.size() > max_targets)
+                targets.assign(1, target{centre(all), 0.5 * diagonal(all)});
+        }
+
+        // True once build has traced photons (even if none of them landed as caustics)
+        bool built() const { return emitted > 0; }
+        size_t size() const { return photons.size(); }
+
+        /* Traces photon_count photons into world and builds the kd-tree, using up to
+           thread_count threads. Photons come from the emitters in lights and from the
+           environment, whose radiance is sky (sampled with environment if not null, else
+           uniformly), in proportion to the power each sends towards the specular objects. */
+        void build(const hittable& world, const light_tree* lights, const environment_map* environment,
+                   const std::function<colour(const vec3&)>& sky, size_t photon_count, int max_depth,
+                   int thread_count) {
+            photons.clear();
+            emitted = photon_count;
+            if (photon_count == 0 || targets.empty())
+                return; // Nothing to cast caustics
+
+            cross_section = 0;
+            double largest = 0;
+            for (const auto& t : targets) {
+                cross_section += pi * t.radius * t.radius;
+                largest = fmax(largest, t.radius);
+            }
+            auto scene = world.bounding_box();
+            scene_centre = centre(scene);
+            scene_radius = 0.5 * diagonal(scene);
+            if (max_radius <= 0)
+                max_radius = largest / 10;
+
+            // Where photons come from: each light by power, and the environment
+            std::vector<double> powers;
+            if (lights)
+                for (size_t i = 0; i < lights->size(); i++)
+                    powers.push_back(pi * (*lights)[i].power);
+            powers.push_back(environment_power(environment, sky));
+            double total_power = 0;
+            for (auto power : powers)
+                total_power += power;
+            if (total_power <= 0)
+                return;
+            sources = distribution_1d(powers.data(), static_cast<int>(powers.size()));
+
+            // Trace in chunks, each into its own list
+            const size_t chunk_size = 4096;
+            size_t chunk_count = (photon_count + chunk_size - 1) / chunk_size;
+            std::vector<std::vector<photon>> chunks(chunk_count);
+            run_tile_jobs(chunk_count, thread_count, [&](size_t c) {
+                begin_pixel(sampler_type::independent, 0, 0, 1, 1);
+                auto end = std::min(photon_count, (c + 1) * chunk_size);
+                for (auto index = c * chunk_size; index < end; index++)
+                    trace_photon(world, lights, environment, sky, index, max_depth, chunks[c]);
+            }, nullptr, false);
+
+            for (auto& chunk : chunks)
+                photons.insert(photons.end(), chunk.begin(), chunk.end());
+
+            int parallel_depth = 0;
+            while ((1 << parallel_depth) < thread_count)
+                parallel_depth++;
+            build_tree(0, photons.size(), parallel_depth);
+        }
+
+        /* Caustic light leaving rec towards the origin of r_in: the bsdf weighted power of
+           the gather_count nearest photons, over the area of the disk they cover. */
+        colour estimate(const ray& r_in, const hit_record& rec) const {
+            if (photons.empty())
+                return colour(0, 0, 0);
+
+            thread_local std::vector<std::pair<double, uint32_t>> nearest;
+            nearest.clear();
+            auto radius_squared = max_radius * max_radius;
+            gather(rec.p, 0, photons.size(), radius_squared, nearest);
+            if (nearest.empty())
+                return colour(0, 0, 0);
+
+            colour sum(0, 0, 0);
+            for (const auto& found : nearest) {
+                const auto& ph = photons[found.second];
+                sum += rec.mat->eval(r_in, rec, -ph.direction) * ph.power;
+            }
+            return sum / (pi * radius_squared);
+        }
+
+    private:
+        struct target {
+            point3 centre;
+            double radius;
+        };
+        static const size_t max_targets = 1024;
+
+        std::vector<photon> photons; // In kd-tree order (see build_tree)
+        size_t emitted = 0;
+        std::vector<target> targets; // Bounding spheres of the specular objects
+        double cross_section = 0; // Sum of the targets' cross sections
+        point3 scene_centre;
+        double scene_radius = 0; // Of a sphere holding the whole scene
+        distribution_1d sources; // Lights first, then the environment
+
+        static point3 centre(const aabb& box) {
+            return point3(0.5*(box.x.min + box.x.max), 0.5*(box.y.min + box.y.max), 0.5*(box.z.min + box.z.max));
+        }
+
+        static double diagonal(const aabb& box) {
+            return vec3(box.x.size(), box.y.size(), box.z.size()).length();
+        }
+
+        // Direction into the environment, and its pdf, for environment photons
+        static vec3 sample_environment(const environment_map* environment, double& pdf) {
+            if (environment)
+                return environment->sample(sample_2d(), pdf);
+            pdf = 1 / (4 * pi);
+            return sample_unit_vector();
+        }
+
+        /* Power the environment sends through the targets: (their cross section) * (integral
+           of the radiance over directions), the integral estimated with a few thousand
+           samples. */
+        double environment_power(const environment_map* environment,
+                                 const std::function<colour(const vec3&)>& sky) const {
+            const int samples = 4096;
+            begin_pixel(sampler_type::independent, 0, 0, 1, 1);
+            begin_pixel_sample(photon_stream, UINT32_MAX);
+            double integral = 0;
+            for (int k = 0; k < samples; k++) {
+                double pdf;
+                auto direction = sample_environment(environment, pdf);
+                if (pdf > 0)
+                    integral += luminance(sky(direction)) / pdf;
+            }
+            return cross_section * integral / samples;
+        }
+
+        // Cosine of the half angle of the cone that sphere t fills as seen from p (-1, the
+        // whole sphere of directions, if p is inside it)
+        static double cone_cos(const point3& p, const target& t) {
+            auto distance_squared = (t.centre - p).length_squared();
+            if (distance_squared <= t.radius * t.radius)
+                return -1;
+            return sqrt(1 - t.radius * t.radius / distance_squared);
+        }
+
+        static bool in_cone(const point3& p, const vec3& direction, const target& t) {
+            auto to_centre = t.centre - p;
+            auto cos_max = cone_cos(p, t);
+            return cos_max < 0 || dot(direction, to_centre) >= cos_max * to_centre.length();
+        }
+
+        // Uniform direction in the cone of sphere t as seen from p
+        static vec3 sample_cone(const point3& p, const target& t) {
+            auto cos_max = cone_cos(p, t);
+            if (cos_max < 0)
+                return sample_unit_vector();
+            auto u = sample_2d();
+            auto cos_theta = 1 - u[0] * (1 - cos_max);
+            auto sin_theta = sqrt(fmax(0.0, 1 - cos_theta*cos_theta));
+            auto phi = 2 * pi * u[1];
+            onb uvw(unit_vector(t.centre - p));
+            return uvw.local(vec3(sin_theta * cos(phi), sin_theta * sin(phi), cos_theta));
+        }
+
+        // Squared distance from point to the line of r (r's direction is a unit vector)
+        static double line_distance_squared(const ray& r, const point3& point) {
+            auto offset = point - r.origin();
+            auto along = dot(offset, r.direction());
+            return offset.length_squared() - along * along;
+        }
+
+        static double luminance(const colour& c) {
+            return 0.2126*c.x() + 0.7152*c.y() + 0.0722*c.z();
+        }
+
+        static const uint64_t photon_stream = 0x70686f746f6e73ULL; // Seeds photon numbers apart from pixels
+
+        // Traces photon number index, adding it to stored if it lands as a caustic
+        void trace_photon(const hittable& world, const light_tree* lights, const environment_map* environment,
+                          const std::function<colour(const vec3&)>& sky, size_t index, int max_depth,
+                          std::vector<photon>& stored) const {
+            begin_pixel_sample(photon_stream, static_cast<uint32_t>(index));
+            auto time = sample_1d();
+
+            double source_pdf;
+            int source;
+            sources.sample(sample_1d(), source_pdf, source);
+            auto probability = source_pdf / sources.size();
+            if (probability <= 0)
+                return;
+
+            ray r;
+            colour power;
+            if (lights && source < static_cast<int>(lights->size())) {
+                // Off a light: a point on its surface, then a direction in the cone of a target
+                // sphere, the target picked in proportion to the cone's solid angle
+                const auto& light = (*lights)[source];
+                point3 p;
+                vec3 normal;
+                if (!light.shape->sample_surface(sample_2d(), time, p, normal))
+                    return;
+                hit_record light_rec;
+                light_rec.p = p;
+                light_rec.set_face_normal(ray(p + normal, -normal, time), normal);
+                auto emission = light.mat->emitted(ray(p + normal, -normal, time), light_rec);
+
+                thread_local std::vector<double> solid_angles;
+                solid_angles.resize(targets.size());
+                double total_solid_angle = 0;
+                for (size_t t = 0; t < targets.size(); t++)
+                    total_solid_angle += solid_angles[t] = 2 * pi * (1 - cone_cos(p, targets[t]));
+                auto u = sample_1d() * total_solid_angle;
+                size_t picked = 0;
+                for (; picked + 1 < targets.size(); picked++) {
+                    if (u < solid_angles[picked])
+                        break;
+                    u -= solid_angles[picked];
+                }
+
+                auto direction = sample_cone(p, targets[picked]);
+                auto cos_light = dot(direction, normal);
+                if (cos_light <= 0)
+                    return;
+                // The direction could have come from every cone holding it, so its pdf is the
+                // number of them over the total solid angle
+                int cones = 0;
+                for (const auto& t : targets)
+                    cones += in_cone(p, direction, t);
+                r = ray(p, direction, time);
+                // Radiance * cos / (pdf of the point * pdf of the direction)
+                power = emission * (cos_light * light.area * total_solid_angle / (fmax(cones, 1) * probability * emitted));
+            } else {
+                // From the environment: a direction into it, then a point on the disk facing it
+                // across a target sphere (picked by cross section), starting outside the scene
+                double direction_pdf;
+                auto direction = sample_environment(environment, direction_pdf);
+                if (direction_pdf <= 0)
+                    return;
+                auto u = sample_1d() * cross_section;
+                size_t picked = 0;
+                for (; picked + 1 < targets.size(); picked++) {
+                    auto area = pi * targets[picked].radius * targets[picked].radius;
+                    if (u < area)
+                        break;
+                    u -= area;
+                }
+
+                const auto& t = targets[picked];
+                onb uvw(direction);
+                auto disk = sample_unit_disk();
+                auto on_disk = t.centre + t.radius * (disk[0] * uvw.u() + disk[1] * uvw.v());
+                auto start = on_disk + (scene_radius + (scene_centre - on_disk).length()) * direction;
+                r = ray(start, -direction, time);
+                // As with the lights, every disk the ray crosses could have picked it
+                int disks = 0;
+                for (const auto& other : targets)
+                    disks += line_distance_squared(r, other.centre) < other.radius * other.radius;
+                power = sky(direction) * (cross_section / (fmax(disks, 1) * direction_pdf * probability * emitted));
+            }
+
+            bool through_specular = false;
+            for (int depth = 0; depth < max_depth; depth++) {
+                hit_record rec;
+                if (!world.hit(r, interval(0.001, infinity), rec))
+                    return;
+                if (!rec.mat->is_specular()) {
+                    // Only light that came through something specular is a caustic
+                    if (through_specular)
+                        stored.push_back(photon{rec.p, unit_vector(r.direction()), power});
+                    return;
+                }
+
+                scatter_record srec;
+                if (!rec.mat->scatter(r, rec, srec))
+                    return;
+                power = power * srec.attenuation;
+                r = srec.scattered;
+                through_specular = true;
+            }
+        }
+
+        /* Builds the kd-tree of photons[begin, end) in place: the median along the longest
+           axis of the photons' bounds goes in the middle, with the photons below it before
+           it and the rest after it, each half a subtree in turn. The first parallel_depth
+           levels build their halves on two threads. */
+        void build_tree(size_t begin, size_t end, int parallel_depth) {
+            if (end - begin <= 1)
+                return;
+
+            aabb bounds = aabb::empty;
+            for (auto i = begin; i < end; i++)
+                bounds = aabb(bounds, aabb(photons[i].p, photons[i].p));
+            int axis = bounds.longest_axis();
+            auto mid = begin + (end - begin) / 2;
+            std::nth_element(photons.begin() + begin, photons.begin() + mid, photons.begin() + end,
+                             [axis](const photon& a, const photon& b) { return a.p[axis] < b.p[axis]; });
+            photons[mid].axis = axis;
+
+            if (parallel_depth > 0) {
+                std::thread lower([&]() { build_tree(begin, mid, parallel_depth - 1); });
+                build_tree(mid + 1, end, parallel_depth - 1);
+                lower.join();
+            } else {
+                build_tree(begin, mid, 0);
+                build_tree(mid + 1, end, 0);
+            }
+        }
+
+        /* Finds the gather_count photons of photons[begin, end) nearest to p within
+           sqrt(radius_squared), kept as a max heap of (squared distance, index) in nearest.
+           Once the heap is full radius_squared shrinks to its largest distance. */
+        void gather(const point3& p, size_t begin, size_t end, double& radius_squared,
+                    std::vector<std::pair<double, uint32_t>>& nearest) const {
+            if (begin >= end)
+                return;
+            auto mid = begin + (end - begin) / 2;
+            const auto& node = photons[mid];
+            auto delta = p[node.axis] - node.p[node.axis];
+
+            // The side of the split holding p first, as it likely holds the nearest photons
+            if (delta < 0)
+                gather(p, begin, mid, radius_squared, nearest);
+            else
+                gather(p, mid + 1, end, radius_squared, nearest);
+
+            auto distance_squared = (node.p - p).length_squared();
+            if (distance_squared < radius_squared) {
+                nearest.emplace_back(distance_squared, static_cast<uint32_t>(mid));
+                std::push_heap(nearest.begin(), nearest.end());
+                if (nearest.size() > static_cast<size_t>(gather_count)) {
+                    std::pop_heap(nearest.begin(), nearest.end());
+                    nearest.pop_back();
+                }
+                if (nearest.size() == static_cast<size_t>(gather_count))
+                    radius_squared = nearest.front().first;
+            }
+
+            if (delta * delta < radius_squared) {
+                if (delta < 0)
+                    gather(p, mid + 1, end, radius_squared, nearest);
+                else
+                    gather(p, begin, mid, radius_squared, nearest);
+            }
+        }
+};
+
+#endif
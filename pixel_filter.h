@@ -0,0 +1,137 @@
+#ifndef PIXEL_FILTER_H
+#define PIXEL_FILTER_H
+
+#include "rtweekend.h"
+
+#include "colour.h"
+#include "tile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+/* Pixel reconstruction filters.
+   By default a pixel is the plain average of the samples that land inside it (a box
+   filter), which lets through detail finer than a pixel as jaggies and moire. A wider,
+   smoother filter weights every sample by its distance to each pixel centre within the
+   filter radius and adds it to all of them (splatting), so a sample counts towards its
+   neighbours too and the image is antialiased better for the same samples:
+     gaussian        exp(-2 x^2) cut to 0 at the radius (1.5): soft, no ringing
+     mitchell        Mitchell-Netravali, B = C = 1/3 (radius 2): sharper, with slight
+                     negative lobes that can ring at hard edges
+     blackman_harris Blackman-Harris window (radius 1.5): between the two
+   The filters are separable, f(x, y) = f(x) f(y), and scaled to integrate to 1, so a pixel's
+   weight sum is about its sample count and box and filtered images can be merged. */
+enum class filter_type {box, gaussian, mitchell, blackman_harris};
+
+inline bool parse_filter_type(const std::string& name, filter_type& type) {
+    if (name == "box") type = filter_type::box;
+    else if (name == "gaussian") type = filter_type::gaussian;
+    else if (name == "mitchell") type = filter_type::mitchell;
+    else if (name == "blackman_harris") type = filter_type::blackman_harris;
+    else return false;
+    return true;
+}
+
+class pixel_filter {
+    public:
+        // radius <= 0 takes the filter's default radius
+        pixel_filter(filter_type type = filter_type::box, double radius = 0) : type(type) {
+            if (radius <= 0)
+                radius = type == filter_type::mitchell ? 2.0 : type == filter_type::box ? 0.5 : 1.5;
+            this->radius = radius;
+
+            // Midpoint rule over [-radius, radius], fine enough for the smooth filters
+            const int steps = 1024;
+            double integral = 0;
+            for (int s = 0; s < steps; s++)
+                integral += shape(radius * (2 * (s + 0.5) / steps - 1));
+            scale = 1 / (integral * 2 * radius / steps);
+        }
+
+        filter_type kind() const { return type; }
+        double width() const { return radius; }
+        bool splats() const { return type != filter_type::box; }
+
+        // How many pixels past the one a sample is taken in it can reach
+        int apron() const { return splats() ? static_cast<int>(std::ceil(radius + 0.5)) - 1 : 0; }
+
+        // 1D weight of a sample x pixels from a pixel centre
+        double evaluate(double x) const {
+            return std::fabs(x) < radius ? scale * shape(x) : 0;
+        }
+
+    private:
+        filter_type type;
+        double radius;
+        double scale = 1; // Makes the filter integrate to 1
+
+        double shape(double x) const {
+            x = std::fabs(x);
+            switch (type) {
+                case filter_type::gaussian:
+                    return fmax(0.0, exp(-2 * x * x) - exp(-2 * radius * radius));
+                case filter_type::mitchell: {
+                    // Defined on [-2, 2], stretched to the radius
+                    const double b = 1.0 / 3, c = 1.0 / 3;
+                    auto t = 2 * x / radius;
+                    if (t < 1)
+                        return ((12 - 9*b - 6*c) * t*t*t + (-18 + 12*b + 6*c) * t*t + (6 - 2*b)) / 6;
+                    if (t < 2)
+                        return ((-b - 6*c) * t*t*t + (6*b + 30*c) * t*t + (-12*b - 48*c) * t + (8*b + 24*c)) / 6;
+                    return 0;
+                }
+                case filter_type::blackman_harris: {
+                    auto t = pi * x / radius;
+                    return 0.35875 + 0.48829 * cos(t) + 0.14128 * cos(2 * t) + 0.01168 * cos(3 * t);
+                }
+                default:
+                    return 1;
+            }
+        }
+};
+
+/* A render thread's private splat buffer for one tile: the tile plus an apron of
+   filter.apron() pixels all round, since samples near the tile's edge reach pixels of its
+   neighbours. Splats go in without any locking; the finished tile is added to the image in
+   one go (framebuffer::add_splats). */
+struct splat_tile {
+    int x0, y0; // Image coordinates of the top left apron pixel (may be outside the image)
+    int width, height;
+    std::vector<colour> sum; // Weighted sample colours
+    std::vector<double> weight; // Sum of the weights
+
+    splat_tile(const tile& t, int apron)
+     : x0(t.x0 - apron), y0(t.y0 - apron), width(t.width() + 2 * apron), height(t.height() + 2 * apron),
+       sum(static_cast<size_t>(width) * height), weight(static_cast<size_t>(width) * height, 0.0) {}
+
+    // Adds sample c taken at image position x, y (pixel centres are at whole numbers)
+    void add(double x, double y, const colour& c, const pixel_filter& filter) {
+        auto r = filter.width();
+        int first_i = std::max(static_cast<int>(std::ceil(x - r)), x0);
+        int last_i = std::min(static_cast<int>(std::floor(x + r)), x0 + width - 1);
+        int first_j = std::max(static_cast<int>(std::ceil(y - r)), y0);
+        int last_j = std::min(static_cast<int>(std::floor(y + r)), y0 + height - 1);
+
+        // Separable, so the horizontal weights are worked out once for all rows
+        double weight_x[16];
+        int columns = std::min(last_i - first_i + 1, 16);
+        for (int k = 0; k < columns; k++)
+            weight_x[k] = filter.evaluate(first_i + k - x);
+
+        for (int j = first_j; j <= last_j; j++) {
+            auto weight_y = filter.evaluate(j - y);
+            if (weight_y == 0)
+                continue;
+            auto first = static_cast<size_t>(j - y0) * width + (first_i - x0);
+            for (int k = 0; k < columns; k++) {
+                auto w = weight_x[k] * weight_y;
+                sum[first + k] += w * c;
+                weight[first + k] += w;
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,182 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+/* Render statistics and progress reporting.
+
+   The hot path (every ray, and every BVH node if counted) only bumps plain counters owned
+   by the current thread (see thread_counters). After each tile a worker publishes its
+   totals to its own slot of relaxed atomics, and a single reporter thread reads the slots
+   at a fixed rate to print percent complete, ETA, throughput and how busy each thread is.
+   Workers never lock, flush or share a cache line with each other. */
+
+struct render_counters {
+    uint64_t samples = 0; // Camera samples traced
+    uint64_t rays = 0; // Rays traced (camera rays plus every bounce)
+    uint64_t nodes_visited = 0; // BVH nodes whose box was tested
+};
+
+// The calling thread's counters. Only ever touched by that thread.
+inline render_counters& thread_counters() {
+    thread_local render_counters counters;
+    return counters;
+}
+
+/* Counting BVH nodes means a thread_local access on every node a ray visits, which shows in
+   the hottest loop of the renderer, so it is only compiled in on request
+   (make DEFINES=-DCOUNT_BVH_NODES). Without it no Mnodes/s is reported. */
+#ifdef COUNT_BVH_NODES
+constexpr bool counting_bvh_nodes = true;
+#else
+constexpr bool counting_bvh_nodes = false;
+#endif
+
+inline void count_bvh_node() {
+    if (counting_bvh_nodes)
+        thread_counters().nodes_visited++;
+}
+
+class progress_reporter {
+    public:
+        std::chrono::milliseconds period{500}; // Time between reports
+
+        progress_reporter(size_t total_tiles, int thread_count, bool print = true)
+         : total_tiles(total_tiles), slots(thread_count), print(print) {}
+
+        ~progress_reporter() { stop(); }
+
+        void start() {
+            start_time = clock::now();
+            if (print)
+                reporter = std::thread(&progress_reporter::report_loop, this);
+        }
+
+        // Called by worker thread `slot` when it starts working, to mark the counters it starts from
+        void begin_worker(int slot) {
+            slots[slot].base = thread_counters();
+        }
+
+        // Called by worker thread `slot` after each tile, with the time spent on it
+        void tile_done(int slot, std::chrono::steady_clock::duration busy) {
+            auto& s = slots[slot];
+            const auto& counters = thread_counters();
+            // Only this thread writes to its slot, so plain relaxed stores are enough
+            s.tiles.store(s.tiles.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            s.busy_ns.store(s.busy_ns.load(std::memory_order_relaxed)
+                            + std::chrono::duration_cast<std::chrono::nanoseconds>(busy).count(),
+                            std::memory_order_relaxed);
+            s.samples.store(counters.samples - s.base.samples, std::memory_order_relaxed);
+            s.rays.store(counters.rays - s.base.rays, std::memory_order_relaxed);
+            s.nodes.store(counters.nodes_visited - s.base.nodes_visited, std::memory_order_relaxed);
+        }
+
+        /* For tiles rendered somewhere else (farm workers): adds the counters work of a tile
+           that took busy to slot. Every slot must be fed by the same thread. */
+        void tile_done(int slot, std::chrono::steady_clock::duration busy, const render_counters& work) {
+            auto& s = slots[slot];
+            auto add = [](std::atomic<uint64_t>& total, uint64_t amount) {
+                total.store(total.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+            };
+            add(s.tiles, 1);
+            add(s.busy_ns, std::chrono::duration_cast<std::chrono::nanoseconds>(busy).count());
+            add(s.samples, work.samples);
+            add(s.rays, work.rays);
+            add(s.nodes, work.nodes_visited);
+        }
+
+        // Stops the reporter thread and prints the final summary
+        void stop() {
+            if (stopped)
+                return;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopped = true;
+            }
+            wake.notify_one();
+            if (reporter.joinable())
+                reporter.join();
+            if (print)
+                std::cerr << '\r' << summary(true) << std::endl;
+        }
+
+        // Totals over all threads so far
+        render_counters totals() const {
+            render_counters total;
+            for (auto& s : slots) {
+                total.samples += s.samples.load(std::memory_order_relaxed);
+                total.rays += s.rays.load(std::memory_order_relaxed);
+                total.nodes_visited += s.nodes.load(std::memory_order_relaxed);
+            }
+            return total;
+        }
+
+    private:
+        using clock = std::chrono::steady_clock;
+
+        // One per thread, padded so threads never write to the same cache line
+        struct alignas(64) slot {
+            std::atomic<uint64_t> tiles{0};
+            std::atomic<uint64_t> samples{0};
+            std::atomic<uint64_t> rays{0};
+            std::atomic<uint64_t> nodes{0};
+            std::atomic<uint64_t> busy_ns{0};
+            render_counters base; // thread_counters() when the worker started (owner thread only)
+        };
+
+        size_t total_tiles;
+        std::vector<slot> slots;
+        bool print;
+        clock::time_point start_time;
+        std::thread reporter;
+        std::mutex mutex;
+        std::condition_variable wake;
+        bool stopped = false;
+
+        void report_loop() {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!wake.wait_for(lock, period, [this] { return stopped; }))
+                std::cerr << '\r' << summary(false) << std::flush;
+        }
+
+        std::string summary(bool final) const {
+            auto elapsed = std::chrono::duration<double>(clock::now() - start_time).count();
+            auto total = totals();
+            uint64_t tiles = 0;
+            for (auto& s : slots)
+                tiles += s.tiles.load(std::memory_order_relaxed);
+
+            std::ostringstream out;
+            out << std::fixed << std::setprecision(1);
+            if (final) {
+                out << "Done: " << tiles << " tiles in " << elapsed << "s";
+            } else {
+                auto fraction = total_tiles > 0 ? double(tiles) / total_tiles : 1.0;
+                out << 100 * fraction << "% | ETA ";
+                if (fraction > 0)
+                    out << elapsed * (1 - fraction) / fraction << "s";
+                else
+                    out << "?";
+            }
+            out << " | " << std::setprecision(2) << total.rays / elapsed / 1e6 << " Mrays/s";
+            if (counting_bvh_nodes)
+                out << " | " << total.nodes_visited / elapsed / 1e6 << " Mnodes/s";
+            out << " | threads busy";
+            out << std::setprecision(0);
+            for (auto& s : slots)
+                out << ' ' << 100 * s.busy_ns.load(std::memory_order_relaxed) / (elapsed * 1e9) << '%';
+            out << "   ";
+            return out.str();
+        }
+};
+
+#endif
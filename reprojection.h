@@ -0,0 +1,123 @@
+#ifndef REPROJECTION_H
+#define REPROJECTION_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+/* Temporal sample reuse for camera fly-throughs of a static scene.
+   When only the camera moves, most of what a pixel saw in the last frame is still there in
+   the next one, just at another pixel. The history keeps the last frame's accumulation
+   image, with its depth and normals, and the camera that rendered it.
+
+   The new frame starts with one probe sample per pixel (with AOVs), which says what the
+   pixel sees now. The probe's hit point is rebuilt from its depth (camera::pixel_point) and
+   projected into the old camera (camera::project), and the four old pixels around where it
+   lands are blended bilinearly, leaving out those that saw a surface at another depth or
+   facing another way. Blending rather than taking the nearest old pixel keeps the image
+   from shifting by up to half a pixel each frame, which built up into smeared edges.
+   Pixels where most of the blend was left out (disocclusions, the image edges,
+   silhouettes) get the full samples_per_pixel of new samples. Glossy and specular
+   surfaces look different from every viewpoint, so pixels that saw one in either frame are
+   never reused, and neither are old pixels whose samples did not all hit (they straddle an
+   edge, so their depth is an average of two surfaces).
+
+   At most samples_per_pixel - 1 old samples are kept, so every reused pixel still takes at
+   least the probe: old samples fade out as new ones arrive, and lighting that was wrong or
+   a blend that was slightly off is not kept forever. */
+class temporal_history {
+    public:
+        double depth_tolerance = 0.02; // Largest depth difference, as a share of the new depth
+        double normal_tolerance = 0.9; // Smallest cosine between the old and new normals
+
+        bool empty() const { return previous.samples.empty(); }
+
+        // Keeps image (which needs AOVs), just rendered by cam, as the history of the next frame
+        void keep(const framebuffer& image, const camera& cam) {
+            previous = image;
+            previous_camera = cam;
+        }
+
+        /* Fills reused with the old samples that pass the tests at each pixel of the frame cam
+           (already initialized) is about to render, and counts with how many new samples each
+           pixel needs on top of probe (one sample per pixel, with AOVs) and those to reach
+           samples_per_pixel. Returns the number of pixels that reuse old samples. */
+        size_t reproject(const camera& cam, const framebuffer& probe, int samples_per_pixel,
+                         framebuffer& reused, std::vector<uint32_t>& counts) const {
+            int width = probe.width, height = probe.height;
+            auto size = static_cast<size_t>(width) * height;
+            reused = framebuffer(width, height);
+            counts.assign(size, static_cast<uint32_t>(std::max(samples_per_pixel - 1, 0)));
+            if (empty() || previous.width != width || previous.height != height)
+                return 0;
+
+            size_t reused_pixels = 0;
+            uint32_t keep_limit = static_cast<uint32_t>(std::max(samples_per_pixel - 1, 0));
+            for (int j = 0; j < height; j++) {
+                for (int i = 0; i < width; i++) {
+                    auto target = static_cast<size_t>(j) * width + i;
+                    const auto& now = probe.aovs[target];
+                    if (now.hits == 0 || now.view_dependent > 0 || keep_limit == 0)
+                        continue;
+
+                    // Where the probe's hit was in the last frame, in (fractional) pixels
+                    auto p = cam.pixel_point(i, j, now.depth / now.hits);
+                    vec3 normal = unit_vector(now.normal);
+                    double x, y, depth;
+                    if (!previous_camera.project(p, x, y, depth))
+                        continue;
+
+                    // Bilinear blend of the four old pixels around it, leaving out those that
+                    // saw something else
+                    auto x0 = static_cast<int>(std::floor(x)), y0 = static_cast<int>(std::floor(y));
+                    auto fx = x - x0, fy = y - y0;
+                    double weight_sum = 0, sample_sum = 0;
+                    colour average(0, 0, 0);
+                    for (int corner = 0; corner < 4; corner++) {
+                        int oi = x0 + (corner & 1), oj = y0 + (corner >> 1);
+                        auto weight = ((corner & 1) ? fx : 1 - fx) * ((corner >> 1) ? fy : 1 - fy);
+                        if (weight <= 0 || !matches(oi, oj, depth, normal))
+                            continue;
+                        auto index = static_cast<size_t>(oj) * width + oi;
+                        weight_sum += weight;
+                        sample_sum += weight * previous.samples[index];
+                        average += weight * previous.average(index);
+                    }
+                    // Most of the footprint must have matched, or the blend leans on one corner
+                    if (weight_sum < 0.5)
+                        continue;
+
+                    auto kept = std::min(static_cast<uint32_t>(sample_sum / weight_sum), keep_limit);
+                    reused.sum[target] = average / weight_sum * kept;
+                    reused.samples[target] = kept;
+                    counts[target] = keep_limit - kept;
+                    reused_pixels++;
+                }
+            }
+            return reused_pixels;
+        }
+
+    private:
+        framebuffer previous;
+        camera previous_camera;
+
+        // True if old pixel i, j saw a diffuse surface at about depth (in the old camera) with
+        // about this normal, in all its samples
+        bool matches(int i, int j, double depth, const vec3& normal) const {
+            if (i < 0 || i >= previous.width || j < 0 || j >= previous.height)
+                return false;
+            const auto& then = previous.aovs[static_cast<size_t>(j) * previous.width + i];
+            if (then.samples == 0 || then.hits != then.samples || then.view_dependent > 0)
+                return false;
+            return std::fabs(then.depth / then.hits - depth) <= depth_tolerance * depth
+                && dot(unit_vector(then.normal), normal) >= normal_tolerance;
+        }
+};
+
+#endif
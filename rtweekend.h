@@ -2,9 +2,9 @@
 #define RTWEEKEND_H
 
 #include <cmath>
+#include <cstdint>
 #include <limits>
 #include <memory>
-#include <random>
 
 // Constants
 
@@ -17,10 +17,63 @@ inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180.0;
 }
 
+/* Small PCG32 random number generator (see pcg-random.org).
+   Used instead of std::mt19937 as it is much cheaper to reseed, which we do at the start
+   of every pixel sample so that any sample can be reproduced on its own. */
+class pcg32 {
+    public:
+        pcg32() { seed(0); }
+        pcg32(uint64_t s) { seed(s); }
+
+        void seed(uint64_t s) {
+            state = 0;
+            next();
+            state += s;
+            next();
+        }
+
+        uint32_t next() {
+            uint64_t old = state;
+            state = old * 6364136223846793005ULL + 1442695040888963407ULL;
+            uint32_t xorshifted = static_cast<uint32_t>(((old >> 18u) ^ old) >> 27u);
+            uint32_t rot = static_cast<uint32_t>(old >> 59u);
+            return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+        }
+
+        // Returns a double in [0,1)
+        double next_double() {
+            return next() * (1.0 / 4294967296.0);
+        }
+
+    private:
+        uint64_t state;
+};
+
+// Scrambles the bits of x (splitmix64 finaliser). Used to turn indices into seeds.
+inline uint64_t mix_bits(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// Each thread gets its own generator so threads never share (or fight over) state.
+inline pcg32& thread_rng() {
+    thread_local pcg32 rng;
+    return rng;
+}
+
+/* Reseed the calling thread's generator for sample number `sample` of pixel `pixel`.
+   The seed only depends on the two indices, so the result of a sample does not depend on
+   which process, thread or order it was rendered in. */
+inline void seed_sample(uint64_t pixel, uint64_t sample) {
+    thread_rng().seed(mix_bits(pixel * 0x9e3779b97f4a7c15ULL ^ mix_bits(sample + 1)));
+}
+
 inline double random_double() {
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-    static std::mt19937 generator;
-    return distribution(generator);
+    return thread_rng().next_double();
 }
 
 inline double random_double(double min, double max) {
@@ -0,0 +1,32 @@
+#!/bin/bash
+
+# Renders the scene with N worker processes (default 4), each taking a slice of the
+# samples, merges the partial images and checks the result against a single-process render.
+# The two only agree up to floating point summation order, so they're compared by RMSE
+# rather than byte for byte.
+# Usage: ./run_split.sh [workers] [samples per pixel] [max RMSE]
+
+WORKERS=${1:-4}
+SPP=${2:-32}
+TOLERANCE=${3:-0.0001}
+OUT=split_output
+mkdir -p $OUT
+rm -f $OUT/part*.acc # Stale parts from a run with more workers would be merged in too
+
+for ((w = 0; w < WORKERS; w++)); do
+    begin=$((w * SPP / WORKERS))
+    end=$(((w + 1) * SPP / WORKERS))
+    env LD_LIBRARY_PATH=./src ./main --spp $SPP --sample-range $begin..$end > $OUT/part$w.acc 2> $OUT/worker$w.txt &
+done
+wait
+
+env LD_LIBRARY_PATH=./src ./main --spp $SPP --sample-range 0..$SPP > $OUT/single.acc 2> $OUT/single.txt
+./merge --reference $OUT/single.acc $OUT/part*.acc > $OUT/merged.ppm 2> $OUT/merge.txt || { cat $OUT/merge.txt; exit 1; }
+
+RMSE=$(sed -n 's/^RMSE against .*: //p' $OUT/merge.txt)
+if awk -v e="$RMSE" -v t="$TOLERANCE" 'BEGIN { exit !(e <= t) }'; then
+    echo "Merged image matches single-process render (RMSE $RMSE)"
+else
+    echo "Merged image DIFFERS from single-process render (RMSE $RMSE, tolerance $TOLERANCE)"
+    exit 1
+fi
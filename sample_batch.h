@@ -0,0 +1,123 @@
+#ifndef SAMPLE_BATCH_H
+#define SAMPLE_BATCH_H
+
+#include "rtweekend.h"
+
+#include <cstdint>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Batched sampling kernels.
+   Turn uniform random numbers into directions several at a time, by direct
+   mapping (no rejection loops, so no unpredictable branches) and with a polynomial sin/cos,
+   so the whole mapping is straight line arithmetic. With SSE2 (every x86-64 CPU) two
+   samples are mapped per instruction; otherwise the same code runs one lane at a time.
+   The results are stored as separate x, y, z arrays in a sample_batch, which the sampler
+   keeps per thread and hands out one sample at a time (see sampler.h). */
+
+enum class batch_kind {
+    unit_vector, // Uniform on the unit sphere
+    cosine_hemisphere // Cosine weighted on the hemisphere around +z
+};
+
+struct sample_batch {
+    static const int size = 8;
+    alignas(16) double x[size];
+    alignas(16) double y[size];
+    alignas(16) double z[size];
+
+    vec3 get(int k) const { return vec3(x[k], y[k], z[k]); }
+};
+
+/* The arithmetic the mappings need, on a double or an SSE2 vector of two doubles. Written
+   as functions (not operators on __m128d, which only GCC and Clang provide) so any
+   compiler with the SSE2 intrinsics builds the vector path. */
+inline double batch_sub(double a, double b) { return a - b; }
+inline double batch_mul(double a, double b) { return a * b; }
+inline double batch_sqrt(double v) { return sqrt(v); }
+inline double batch_max0(double v) { return v > 0 ? v : 0; }
+template <typename T> T batch_set(double v); // v in every lane
+template <> inline double batch_set<double>(double v) { return v; }
+#if defined(__SSE2__)
+inline __m128d batch_sub(__m128d a, __m128d b) { return _mm_sub_pd(a, b); }
+inline __m128d batch_mul(__m128d a, __m128d b) { return _mm_mul_pd(a, b); }
+inline __m128d batch_sqrt(__m128d v) { return _mm_sqrt_pd(v); }
+inline __m128d batch_max0(__m128d v) { return _mm_max_pd(v, _mm_setzero_pd()); }
+template <> inline __m128d batch_set<__m128d>(double v) { return _mm_set1_pd(v); }
+#endif
+
+/* sin and cos of 2*pi*u for u in [0,1), to about 1e-11. Taylor series of the half angle
+   (in [-pi/2, pi/2), where they converge fast) followed by the double angle formulas.
+   T is double or an SSE2 vector of two doubles. */
+template <typename T>
+inline void sincos_turn(T u, T& s, T& c) {
+    T h = batch_mul(batch_sub(u, batch_set<T>(0.5)), batch_set<T>(pi));
+    T h2 = batch_mul(h, h);
+    // One Horner step: coefficient - h2 * x. The coefficients are 1/n! with alternating signs
+    auto step = [&](double coefficient, T x) { return batch_sub(batch_set<T>(coefficient), batch_mul(h2, x)); };
+    T sh = step(1.0/6227020800, batch_set<T>(1.0/1307674368000));
+    sh = step(1.0/39916800, sh);
+    sh = step(1.0/362880, sh);
+    sh = step(1.0/5040, sh);
+    sh = step(1.0/120, sh);
+    sh = step(1.0/6, sh);
+    sh = batch_mul(h, step(1.0, sh));
+    T ch = step(1.0/87178291200, batch_set<T>(1.0/20922789888000));
+    ch = step(1.0/479001600, ch);
+    ch = step(1.0/3628800, ch);
+    ch = step(1.0/40320, ch);
+    ch = step(1.0/720, ch);
+    ch = step(1.0/24, ch);
+    ch = step(1.0/2, ch);
+    ch = step(1.0, ch);
+    // 2*pi*u = 2h + pi, and sin(a + pi) = -sin(a), cos(a + pi) = -cos(a)
+    s = batch_mul(batch_mul(batch_set<T>(-2.0), sh), ch);
+    c = batch_sub(batch_mul(batch_mul(batch_set<T>(2.0), sh), sh), batch_set<T>(1.0));
+}
+
+// Maps two uniform numbers to a sample of the given kind
+template <typename T>
+inline void map_batch_sample(batch_kind kind, T u1, T u2, T& x, T& y, T& z) {
+    T s, c;
+    sincos_turn(u2, s, c);
+
+    T r;
+    T one = batch_set<T>(1.0);
+    if (kind == batch_kind::unit_vector) {
+        z = batch_sub(one, batch_mul(batch_set<T>(2.0), u1));
+        r = batch_sqrt(batch_max0(batch_sub(one, batch_mul(z, z))));
+    } else {
+        // Malley's method: project a uniform disk point up onto the hemisphere
+        r = batch_sqrt(u1);
+        z = batch_sqrt(batch_max0(batch_sub(one, u1)));
+    }
+    x = batch_mul(r, c);
+    y = batch_mul(r, s);
+}
+
+// Fills the batch with samples of the given kind, drawing the random numbers from rng
+inline void fill_batch(sample_batch& batch, batch_kind kind, pcg32& rng) {
+    alignas(16) double u1[sample_batch::size];
+    alignas(16) double u2[sample_batch::size];
+    for (int k = 0; k < sample_batch::size; k++) {
+        u1[k] = rng.next_double();
+        u2[k] = rng.next_double();
+    }
+
+#if defined(__SSE2__)
+    for (int k = 0; k < sample_batch::size; k += 2) {
+        __m128d x, y, z;
+        map_batch_sample(kind, _mm_load_pd(u1 + k), _mm_load_pd(u2 + k), x, y, z);
+        _mm_store_pd(batch.x + k, x);
+        _mm_store_pd(batch.y + k, y);
+        _mm_store_pd(batch.z + k, z);
+    }
+#else
+    for (int k = 0; k < sample_batch::size; k++)
+        map_batch_sample(kind, u1[k], u2[k], batch.x[k], batch.y[k], batch.z[k]);
+#endif
+}
+
+#endif
@@ -0,0 +1,425 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "rtweekend.h"
+
+#include "blue_noise.h"
+#include "sample_batch.h"
+#include "vec2.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Sample generation for the integrator.
+
+   Every random decision made while tracing a pixel sample (where in the pixel, where on
+   the lens, which bounce direction, reflect or refract...) draws from a numbered dimension
+   of that sample. The camera starts each pixel with begin_pixel, each sample with
+   begin_pixel_sample and each bounce with begin_bounce, which fix the dimension numbers,
+   so e.g. the first bounce direction of every sample of a pixel always comes from the
+   same dimension whatever happened before it.
+
+   With the independent sampler every dimension is just random_double(). With the Sobol
+   sampler each dimension is an Owen scrambled (0,2)-sequence: the samples of a pixel are
+   stratified in every 1D and 2D projection (any power of two prefix covers the domain
+   evenly), which converges much faster than independent random numbers. Each dimension and
+   each pixel gets its own scramble and sample order, so dimensions are uncorrelated with
+   each other and the error pattern is decorrelated between pixels.
+   (Burley 2020, "Practical Hash-based Owen Scrambling")
+
+   The stratified sampler precomputes correlated multi-jittered patterns of the camera's
+   samples_per_pixel points for the pixel footprint and the lens of each pixel: every point
+   falls in its own cell of an m x n grid and in its own row and column of a finer N x N
+   grid. The remaining dimensions are independent random numbers.
+   (Kensler 2013, "Correlated Multi-Jittered Sampling")
+
+   The blue noise sampler is aimed at low sample count previews. Sample n of every pixel
+   is the same rank-1 lattice point (the R2 / golden ratio sequence, which is well spread
+   for any n), shifted modulo 1 (a Cranley-Patterson rotation) by a blue noise mask value
+   for the pixel. Neighbouring pixels get very different shifts, so at 1-8 spp the error
+   looks like fine grain instead of white noise. Each dimension reads the mask at its own
+   toroidal offset, which keeps the dimensions apart.
+   (Heitz & Belcour 2019, Roberts 2018 "The Unreasonable Effectiveness of Quasirandom Sequences")
+*/
+
+enum class sampler_type {
+    independent, // Uniform random numbers (random_double)
+    sobol, // Owen scrambled, shuffled Sobol (0,2)-sequence per dimension
+    stratified, // Correlated multi-jittered pixel and lens patterns, independent elsewhere
+    blue_noise // Rank-1 lattice with blue noise rotations per pixel
+};
+
+inline bool parse_sampler_type(const std::string& name, sampler_type& type) {
+    if (name == "independent") type = sampler_type::independent;
+    else if (name == "sobol") type = sampler_type::sobol;
+    else if (name == "stratified") type = sampler_type::stratified;
+    else if (name == "blue_noise") type = sampler_type::blue_noise;
+    else return false;
+    return true;
+}
+
+// Dimensions used by the camera before the first bounce: pixel (2), lens (2), time (1)
+const uint32_t pixel_dimension = 0;
+const uint32_t lens_dimension = 2;
+const uint32_t time_dimension = 4;
+const uint32_t camera_dimensions = 5;
+// Dimensions reserved for each bounce: one 2D direction and one 1D choice, then the light
+// sample (1D light choice, 2D point on the light), then the 2D environment sample, then the
+// path guide's (1D guide or bsdf choice, 2D guided direction)
+const uint32_t light_dimension_offset = 3;
+const uint32_t environment_dimension_offset = 6;
+const uint32_t guiding_dimension_offset = 8;
+const uint32_t bounce_dimensions = 11;
+
+/* Sobol and scrambling helpers */
+
+inline uint32_t reverse_bits(uint32_t x) {
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// Laine-Karras style hash: a bit only depends on itself and the bits below it
+inline uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+// Owen scramble: a random permutation of every level of the binary tree of the domain
+inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+    return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+inline uint32_t hash_combine(uint32_t seed, uint32_t value) {
+    return static_cast<uint32_t>(mix_bits((uint64_t(seed) << 32) | value));
+}
+
+/* First two dimensions of the Sobol sequence. Dimension 0 is the van der Corput sequence;
+   dimension 1 has primitive polynomial x + 1 (direction numbers v[i] = v[i-1] ^ v[i-1] >> 1). */
+inline uint32_t sobol(uint32_t index, int dimension) {
+    if (dimension == 0)
+        return reverse_bits(index);
+
+    uint32_t result = 0;
+    uint32_t direction = 0x80000000u;
+    for (; index; index >>= 1) {
+        if (index & 1)
+            result ^= direction;
+        direction ^= direction >> 1;
+    }
+    return result;
+}
+
+/* Correlated multi-jittered sampling helpers (Kensler 2013) */
+
+// Pseudo-random permutation of i in [0, l), selected by p
+inline uint32_t cmj_permute(uint32_t i, uint32_t l, uint32_t p) {
+    uint32_t w = l - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= p; i *= 0xe170893du; i ^= p >> 16;
+        i ^= (i & w) >> 4; i ^= p >> 8; i *= 0x0929eb3fu; i ^= p >> 23;
+        i ^= (i & w) >> 1; i *= 1 | p >> 27; i *= 0x6935fa69u;
+        i ^= (i & w) >> 11; i *= 0x74dcb303u; i ^= (i & w) >> 2;
+        i *= 0x9e501cc3u; i ^= (i & w) >> 2; i *= 0xc860a3dfu;
+        i &= w; i ^= i >> 5;
+    } while (i >= l); // Cycle walk until the value lands inside [0, l)
+    return (i + p) % l;
+}
+
+// Pseudo-random number in [0,1) from i, selected by p
+inline double cmj_random(uint32_t i, uint32_t p) {
+    i ^= p; i ^= i >> 17; i ^= i >> 10; i *= 0xb36534e5u; i ^= i >> 12;
+    i ^= i >> 21; i *= 0x93fc4795u; i ^= 0xdf6e307fu; i ^= i >> 17;
+    i *= 1 | p >> 18;
+    return i * (1.0 / 4294967808.0);
+}
+
+// Fills pattern with a correlated multi-jittered pattern of count points, selected by p
+inline void cmj_pattern(std::vector<vec2>& pattern, uint32_t count, uint32_t p) {
+    auto m = std::max(1u, static_cast<uint32_t>(sqrt(double(count)))); // Columns
+    auto n = (count + m - 1) / m; // Rows
+
+    pattern.resize(count);
+    for (uint32_t s = 0; s < count; s++) {
+        auto cell = cmj_permute(s, count, p * 0x51633e2du); // Shuffled sample order
+        auto sx = cmj_permute(cell % m, m, p * 0xa511e9b3u);
+        auto sy = cmj_permute(cell / m, n, p * 0x63d83595u);
+        auto jx = cmj_random(cell, p * 0xa399d265u);
+        auto jy = cmj_random(cell, p * 0x711ad6a5u);
+        pattern[s] = vec2((cell % m + (sy + jx) / n) / m,
+                          (cell / m + (sx + jy) / m) / n);
+    }
+}
+
+/* Per thread sampler state */
+
+// A sample batch and the key it was filled for (see batched_sample)
+struct batch_slot {
+    sample_batch batch;
+    uint64_t key = UINT64_MAX;
+};
+
+struct sampler_state {
+    sampler_type type = sampler_type::independent;
+    uint32_t pixel_seed = 0; // Decorrelates the scrambles of different pixels
+    int pixel_x = 0, pixel_y = 0; // Image position of the pixel
+    uint32_t sample_index = 0;
+    uint32_t split = 0; // Which of the paths split from the sample's camera ray (see begin_split)
+    uint32_t stream_seed = 0; // pixel_seed, or the current split's own seed
+    uint32_t dimension = 0; // Next dimension to be drawn
+    std::vector<vec2> pixel_pattern; // Stratified sampler: this pixel's footprint samples
+    std::vector<vec2> lens_pattern; // Stratified sampler: this pixel's lens samples
+
+    /* Independent sampler: batches of precomputed unit vectors and cosine weighted
+       directions. A batch holds draw d of sample_batch::size consecutive samples of one
+       path stream, so the first batched_draws draws of each sample each keep a batch that
+       lasts the next samples of the pixel too (see batched_sample). */
+    static const uint32_t batched_draws = 8; // Later draws of a sample are mapped one at a time
+    batch_slot direction_batches[batched_draws];
+    uint32_t directions_drawn = 0; // Unit vectors drawn so far in this sample
+    batch_slot cosine_batches[batched_draws];
+    uint32_t cosines_drawn = 0; // Cosine weighted directions drawn so far in this sample
+};
+
+inline sampler_state& thread_sampler() {
+    thread_local sampler_state state;
+    return state;
+}
+
+/* Starts pixel i, j of an image_width wide image, which takes samples_per_pixel samples in
+   total (across all sample ranges, so that partial renders of the pixel share one pattern). */
+inline void begin_pixel(sampler_type type, int i, int j, int image_width, uint32_t samples_per_pixel) {
+    auto pixel = uint64_t(j) * image_width + i;
+    auto& state = thread_sampler();
+    state.type = type;
+    state.pixel_x = i;
+    state.pixel_y = j;
+    state.pixel_seed = static_cast<uint32_t>(mix_bits(pixel ^ 0x5851f42d4c957f2dULL));
+    state.stream_seed = state.pixel_seed;
+    if (type == sampler_type::stratified) {
+        cmj_pattern(state.pixel_pattern, samples_per_pixel, hash_combine(state.pixel_seed, pixel_dimension));
+        cmj_pattern(state.lens_pattern, samples_per_pixel, hash_combine(state.pixel_seed, lens_dimension));
+    }
+}
+
+// Starts sample number `sample` of the current pixel. Also reseeds random_double.
+inline void begin_pixel_sample(uint64_t pixel, uint32_t sample) {
+    seed_sample(pixel, sample);
+
+    auto& state = thread_sampler();
+    state.sample_index = sample;
+    state.split = 0;
+    state.stream_seed = state.pixel_seed;
+    state.dimension = 0;
+    state.directions_drawn = 0;
+    state.cosines_drawn = 0;
+}
+
+/* Starts path `split` of the current sample, when several paths continue from its camera
+   ray (primary hit splitting, see camera.h). Split 0 is the sample's own path. The others
+   draw their bounce dimensions from their own scramble (Sobol), mask offset (blue noise)
+   or random stream, so every split is a separate path and renders stay reproducible. */
+inline void begin_split(uint32_t split) {
+    auto& state = thread_sampler();
+    state.split = split;
+    state.stream_seed = split ? hash_combine(state.pixel_seed, 0x73706c00u + split) : state.pixel_seed;
+    seed_sample((uint64_t(state.stream_seed) << 32) | split, state.sample_index);
+    state.directions_drawn = 0;
+    state.cosines_drawn = 0;
+}
+
+// Skips count dimensions that this sample does not need (e.g. the lens without defocus)
+inline void skip_dimensions(uint32_t count) {
+    thread_sampler().dimension += count;
+}
+
+// Moves on to the dimensions of the given bounce (0 for the first surface hit), starting
+// offset dimensions into it
+inline void begin_bounce(int bounce, uint32_t offset = 0) {
+    thread_sampler().dimension = camera_dimensions + bounce * bounce_dimensions + offset;
+}
+
+// Scrambled Sobol point of the current sample in (Sobol) dimension 0 or 1 of `dimension`
+inline double sobol_sample(const sampler_state& state, uint32_t dimension, int axis) {
+    auto seed = hash_combine(state.stream_seed, dimension);
+    auto index = nested_uniform_scramble(state.sample_index, seed);
+    auto value = nested_uniform_scramble(sobol(index, axis), hash_combine(seed, axis));
+    return value * (1.0 / 4294967296.0);
+}
+
+// Blue noise mask value of the current pixel for the given dimension
+inline double blue_noise_shift(const sampler_state& state, uint32_t dimension) {
+    dimension += state.split * 4099; // Splits read the mask past every dimension of the path
+    // R2 sequence offsets put each dimension's view of the mask far from the others
+    auto ox = static_cast<int>(blue_noise_mask::size * fmod(dimension * 0.7548776662466927, 1.0));
+    auto oy = static_cast<int>(blue_noise_mask::size * fmod(dimension * 0.5698402909980532, 1.0));
+    return blue_noise_mask::get().value(state.pixel_x + ox, state.pixel_y + oy);
+}
+
+// Rank-1 lattice point of the current sample, rotated by the pixel's blue noise shift
+inline double lattice_sample(const sampler_state& state, uint32_t dimension, double alpha) {
+    auto value = state.sample_index * alpha + blue_noise_shift(state, dimension);
+    return value - floor(value);
+}
+
+// Returns the next dimension of the current sample, in [0,1)
+inline double sample_1d() {
+    auto& state = thread_sampler();
+    auto dimension = state.dimension++;
+    switch (state.type) {
+        case sampler_type::sobol:
+            return sobol_sample(state, dimension, 0);
+        case sampler_type::blue_noise:
+            return lattice_sample(state, dimension, 0.6180339887498949);
+        default:
+            return random_double();
+    }
+}
+
+/* Point of the current sample in a stratified pattern. Samples past the pattern's
+   samples_per_pixel points (sample ranges past the end, later frames of a sequence) go
+   round it again: each round takes the points in its own order, shifted by its own offset
+   modulo 1, so every full round is a differently placed stratified set. */
+inline vec2 stratified_sample(const sampler_state& state, const std::vector<vec2>& pattern, uint32_t dimension) {
+    auto count = static_cast<uint32_t>(pattern.size());
+    auto round = state.sample_index / count;
+    auto index = state.sample_index % count;
+    if (round == 0)
+        return pattern[index];
+
+    auto seed = hash_combine(hash_combine(state.pixel_seed, dimension), round);
+    auto point = pattern[cmj_permute(index, count, seed)];
+    auto x = point[0] + cmj_random(0, seed);
+    auto y = point[1] + cmj_random(1, seed);
+    return vec2(x < 1 ? x : x - 1, y < 1 ? y : y - 1);
+}
+
+// Returns the next two dimensions of the current sample, in [0,1)^2
+inline vec2 sample_2d() {
+    auto& state = thread_sampler();
+    auto dimension = state.dimension;
+    state.dimension += 2;
+    if (state.type == sampler_type::stratified && (dimension == pixel_dimension || dimension == lens_dimension)) {
+        const auto& pattern = dimension == pixel_dimension ? state.pixel_pattern : state.lens_pattern;
+        if (!pattern.empty())
+            return stratified_sample(state, pattern, dimension);
+    }
+    switch (state.type) {
+        case sampler_type::sobol:
+            return vec2(sobol_sample(state, dimension, 0), sobol_sample(state, dimension, 1));
+        case sampler_type::blue_noise:
+            return vec2(lattice_sample(state, dimension, 0.7548776662466927),
+                        lattice_sample(state, dimension + 1, 0.5698402909980532));
+        default: {
+            auto x = random_double();
+            return vec2(x, random_double());
+        }
+    }
+}
+
+/* Hands out draw number `draw` of the current sample from the independent sampler's
+   batches, or returns false if the draw is past the batched ones. The batch holding it
+   covers the same draw of sample_batch::size consecutive samples of the current path
+   stream and is filled from its own random stream, seeded from the stream, the draw and
+   the chunk of samples, so the values only depend on which sample and draw they are (not
+   on the sample range being rendered or on what the thread rendered before). */
+inline bool batched_sample(batch_slot* slots, batch_kind kind, uint32_t draw, vec3& sample) {
+    if (draw >= sampler_state::batched_draws)
+        return false;
+    const auto& state = thread_sampler();
+    auto chunk = state.sample_index / sample_batch::size;
+    // Chunks past 2^24 (over 134M samples per pixel) would run into the draw bits
+    auto key = (uint64_t(state.stream_seed) << 32) | (uint64_t(draw) << 24) | (chunk & 0xffffff);
+    auto& slot = slots[draw];
+    if (slot.key != key) {
+        pcg32 rng(mix_bits(key ^ (uint64_t(kind) << 60)));
+        fill_batch(slot.batch, kind, rng);
+        slot.key = key;
+    }
+    sample = slot.batch.get(state.sample_index % sample_batch::size);
+    return true;
+}
+
+/* Mappings from samples to directions and disks. Unlike the rejection sampling in vec3.h
+   these take exactly one 2D sample, which keeps the stratification of the sampler.
+   The independent sampler has no stratification to keep, so it takes the first few
+   directions of each sample from the batched kernels instead. */
+
+// Uniformly distributed direction on the unit sphere
+inline vec3 sample_unit_vector() {
+    auto& state = thread_sampler();
+    vec3 batched;
+    if (state.type == sampler_type::independent
+        && batched_sample(state.direction_batches, batch_kind::unit_vector, state.directions_drawn++, batched)) {
+        state.dimension += 2;
+        return batched;
+    }
+
+    auto u = sample_2d();
+    auto z = 1 - 2*u[0];
+    auto r = sqrt(fmax(0.0, 1 - z*z));
+    auto phi = 2*pi*u[1];
+    return vec3(r*cos(phi), r*sin(phi), z);
+}
+
+/* Cosine weighted direction on the hemisphere around +z (pdf cos(theta) / pi). Built by
+   projecting a uniform disk point up onto the hemisphere (Malley's method). */
+inline vec3 sample_cosine_hemisphere() {
+    auto& state = thread_sampler();
+    vec3 batched;
+    if (state.type == sampler_type::independent
+        && batched_sample(state.cosine_batches, batch_kind::cosine_hemisphere, state.cosines_drawn++, batched)) {
+        state.dimension += 2;
+        return batched;
+    }
+
+    auto u = sample_2d();
+    auto r = sqrt(u[0]);
+    auto phi = 2*pi*u[1];
+    return vec3(r*cos(phi), r*sin(phi), sqrt(fmax(0.0, 1 - u[0])));
+}
+
+/* Uniformly distributed point in the unit disk (z = 0), using the concentric mapping: the
+   square is mapped ring by ring onto the disk, so nearby samples stay nearby and strata
+   keep their shape (Shirley & Chiu 1997).
+   The independent sampler has nothing to keep, and one lens point per sample is too few to
+   be worth batching, so it uses the rejection loop of vec3.h: 1.27 tries on average, with
+   no sin and cos, is faster than either mapping. */
+inline vec3 sample_unit_disk() {
+    auto& state = thread_sampler();
+    if (state.type == sampler_type::independent) {
+        state.dimension += 2;
+        return random_in_unit_disk();
+    }
+
+    auto u = sample_2d();
+    auto a = 2*u[0] - 1;
+    auto b = 2*u[1] - 1;
+    if (a == 0 && b == 0)
+        return vec3(0, 0, 0);
+
+    double r, theta;
+    if (fabs(a) > fabs(b)) {
+        r = a;
+        theta = (pi / 4) * (b / a);
+    } else {
+        r = b;
+        theta = (pi / 2) - (pi / 4) * (a / b);
+    }
+    return vec3(r*cos(theta), r*sin(theta), 0);
+}
+
+#endif
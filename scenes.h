@@ -0,0 +1,361 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "material.h"
+#include "sphere.h"
+#include "triangle.h"
+
+#include <string>
+#include <vector>
+
+/* Scene setups. Each fills world with the scene's objects and sets up cam to view it.
+   Those taking meshes also add each group of objects that belongs together (a mesh of a
+   model) to a list of its own there, for animations to move separately (see tlas.h). */
+
+/* Loads the model at path (anything Assimp reads) as triangles shaded by their normals,
+   viewed from just in front of the origin. Returns false if the model has no triangles. */
+inline bool load_model_scene(const std::string& path, hittable_list& world, camera& cam,
+                             std::vector<hittable_list>* meshes = nullptr)
+{
+    auto material_normal = std::make_shared<shade_normal>();
+    //auto material_ground = std::make_shared<lambertian>(colour(0.8, 0.8, 0.0));
+    //auto material_center = std::make_shared<lambertian>(colour(0.1, 0.2, 0.5));
+    //auto material_left   = std::make_shared<dielectric>(1.50);
+    //auto material_bubble = std::make_shared<dielectric>(1.00 / 1.50);
+    //auto material_right  = std::make_shared<metal>(colour(0.8, 0.6, 0.2), 0.0);
+
+    //world.add(std::make_shared<sphere>(point3( 0.0, -100.5, -1.0), 100.0, material_ground));
+    //world.add(std::make_shared<sphere>(point3( -1.5,    0.0, 0.5),   0.5, material_center));
+    //world.add(std::make_shared<sphere>(point3(0.0, 1.0, 0.0),   0.5, material_center));
+    //world.add(std::make_shared<sphere>(point3( 0.0,    0.0, -1.2),   0.4, material_bubble));
+    //world.add(std::make_shared<sphere>(point3( 2.0, 0.0, 0.5),   0.5, material_right));
+    //world.add(std::make_shared<sphere>(point3( 0.0, 0.0, 3.0),   0.5, material_right));
+
+    Model model = Model(path);
+    mesh_to_hittables(model, world, material_normal, vec3(0.0, 0.0, 0.0), meshes);
+    if (world.objects.empty()) {
+        std::cerr << "ERROR::SCENE:: No triangles loaded from " << path << std::endl;
+        return false;
+    }
+
+    cam.aspect_ratio      = 16.0 / 9.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 32;
+    cam.max_depth         = 50;
+
+    cam.vfov     = 90;
+    cam.lookfrom = point3(0,0,1.5);
+    cam.lookat   = point3(0,0,1);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0.0;
+    cam.focus_dist    = 1.0;
+
+    return true;
+}
+
+inline void load_final_scene(hittable_list& world, camera& cam)
+{
+    // The layout is random, but must come out the same in every process rendering it
+    thread_rng().seed(0);
+
+    cam.aspect_ratio      = 16.0 / 9.0;
+    cam.image_width       = 1200;
+    cam.samples_per_pixel = 500;
+    cam.max_depth         = 50;
+
+    cam.vfov     = 20;
+    cam.lookfrom = point3(13,2,3);
+    cam.lookat   = point3(0,0,0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0.6;
+    cam.focus_dist    = 10.0;
+
+    auto ground_material = std::make_shared<lambertian>(colour(0.5, 0.5, 0.5));
+    world.add(std::make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
+
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            auto choose_mat = random_double();
+            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
+
+            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
+                std::shared_ptr<material> sphere_material;
+
+                if (choose_mat < 0.8) {
+                    // diffuse
+                    auto albedo = colour::random() * colour::random();
+                    sphere_material = std::make_shared<lambertian>(albedo);
+                    world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
+                } else if (choose_mat < 0.95) {
+                    // metal
+                    auto albedo = colour::random(0.5, 1);
+                    auto fuzz = random_double(0, 0.5);
+                    sphere_material = std::make_shared<metal>(albedo, fuzz);
+                    world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
+                } else {
+                    // glass
+                    sphere_material = std::make_shared<dielectric>(1.5);
+                    world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
+                }
+            }
+        }
+    }
+
+    auto material1 = std::make_shared<dielectric>(1.5);
+    world.add(std::make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+
+    auto material2 = std::make_shared<lambertian>(colour(0.4, 0.2, 0.1));
+    world.add(std::make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+
+    auto material3 = std::make_shared<metal>(colour(0.7, 0.6, 0.5), 0.0);
+    world.add(std::make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+}
+
+inline void load_final_scene_motion_blur(hittable_list& world, camera& cam)
+{
+    thread_rng().seed(0);
+
+    cam.aspect_ratio      = 16.0 / 9.0;
+    cam.image_width       = 1200;
+    cam.samples_per_pixel = 500;
+    cam.max_depth         = 50;
+
+    cam.vfov     = 20;
+    cam.lookfrom = point3(13,2,3);
+    cam.lookat   = point3(0,0,0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0.6;
+    cam.focus_dist    = 10.0;
+
+    auto ground_material = std::make_shared<lambertian>(colour(0.5, 0.5, 0.5));
+    world.add(std::make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
+
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            auto choose_mat = random_double();
+            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
+
+            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
+                std::shared_ptr<material> sphere_material;
+
+                if (choose_mat < 0.8) {
+                    // diffuse
+                    auto albedo = colour::random() * colour::random();
+                    sphere_material = std::make_shared<lambertian>(albedo);
+                    auto center2 = center + vec3(0, random_double(0,.5), 0);
+                    world.add(std::make_shared<sphere>(center, center2, 0.2, sphere_material));
+                } else if (choose_mat < 0.95) {
+                    // metal
+                    auto albedo = colour::random(0.5, 1);
+                    auto fuzz = random_double(0, 0.5);
+                    sphere_material = std::make_shared<metal>(albedo, fuzz);
+                    world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
+                } else {
+                    // glass
+                    sphere_material = std::make_shared<dielectric>(1.5);
+                    world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
+                }
+            }
+        }
+    }
+
+    auto material1 = std::make_shared<dielectric>(1.5);
+    world.add(std::make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+
+    auto material2 = std::make_shared<lambertian>(colour(0.4, 0.2, 0.1));
+    world.add(std::make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+
+    auto material3 = std::make_shared<metal>(colour(0.7, 0.6, 0.5), 0.0);
+    world.add(std::make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+}
+
+/* A few spheres lit only by a ceiling of thousands of small emissive triangles (no sky),
+   for testing light sampling. The ceiling is the scene's one mesh. */
+inline void load_many_lights_scene(hittable_list& world, camera& cam, std::vector<hittable_list>* meshes = nullptr)
+{
+    thread_rng().seed(0);
+
+    cam.aspect_ratio      = 16.0 / 9.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 64;
+    cam.max_depth         = 50;
+
+    cam.vfov     = 40;
+    cam.lookfrom = point3(0,1.2,7);
+    cam.lookat   = point3(0,0.7,0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0.0;
+    cam.focus_dist    = 7.0;
+    cam.sky           = false;
+
+    auto ground_material = std::make_shared<lambertian>(colour(0.5, 0.5, 0.5));
+    world.add(std::make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
+
+    world.add(std::make_shared<sphere>(point3(-2.2, 1, 0), 1.0, std::make_shared<dielectric>(1.5)));
+    world.add(std::make_shared<sphere>(point3(0, 1, 0), 1.0, std::make_shared<lambertian>(colour(0.7, 0.3, 0.2))));
+    world.add(std::make_shared<sphere>(point3(2.2, 1, 0), 1.0, std::make_shared<metal>(colour(0.7, 0.6, 0.5), 0.1)));
+    for (int a = -5; a <= 5; a++) {
+        auto albedo = colour::random() * colour::random();
+        world.add(std::make_shared<sphere>(point3(a * 0.8, 0.2, 2.0), 0.2, std::make_shared<lambertian>(albedo)));
+    }
+
+    // Ceiling: a 64 x 64 grid of small, bright square lights (two triangles each, facing
+    // down), about two thirds of them lit in random colours
+    const int grid = 64;
+    const double extent = 12.0, height = 3.0;
+    const double cell = extent / grid, size = 0.3 * cell;
+    hittable_list ceiling;
+    for (int i = 0; i < grid; i++) {
+        for (int k = 0; k < grid; k++) {
+            if (random_double() > 0.65)
+                continue;
+            auto light = std::make_shared<diffuse_light>(colour::random(0.2, 1) * 40);
+            point3 a(-extent/2 + i*cell, height, -extent/2 + k*cell);
+            point3 b = a + vec3(size, 0, 0);
+            point3 c = a + vec3(0, 0, size);
+            point3 d = a + vec3(size, 0, size);
+            ceiling.add(std::make_shared<triangle>(a, b, c, light));
+            ceiling.add(std::make_shared<triangle>(b, d, c, light));
+        }
+    }
+    for (const auto& object : ceiling.objects)
+        world.add(object);
+    if (meshes)
+        meshes->push_back(ceiling);
+}
+
+/* Ten thousand Newell teapots on a 100 x 100 grid, for testing instancing: the teapot's
+   triangles are loaded once into their own BVH, and every teapot is an instance of it with
+   its own turn, size and colour. Returns false if the teapot model could not be loaded. */
+inline bool load_teapots_scene(hittable_list& world, camera& cam)
+{
+    thread_rng().seed(0);
+
+    hittable_list triangles;
+    Model model("./test_objects/newell_teaset/teapot.obj");
+    mesh_to_hittables(model, triangles, std::make_shared<lambertian>(colour(0.8, 0.8, 0.8)), vec3(0, 0, 0));
+    if (triangles.objects.empty()) {
+        std::cerr << "ERROR::SCENE:: No triangles loaded for the teapots" << std::endl;
+        return false;
+    }
+    auto teapot = make_blas(triangles);
+
+    // Move the model to stand on the origin and scale it to 1 across
+    auto box = teapot->bounding_box();
+    auto to_unit = affine_transform::scale(1 / fmax(box.x.size(), box.z.size()))
+                 * affine_transform::translate(vec3(-0.5*(box.x.min + box.x.max), -box.y.min, -0.5*(box.z.min + box.z.max)));
+
+    std::vector<std::shared_ptr<material>> palette;
+    for (int m = 0; m < 8; m++)
+        palette.push_back(std::make_shared<lambertian>(colour::random(0.2, 0.9)));
+
+    const int grid = 100;
+    const double spacing = 1.5;
+    for (int i = 0; i < grid; i++) {
+        for (int k = 0; k < grid; k++) {
+            point3 position((i - grid/2) * spacing, 0, (k - grid/2) * spacing);
+            auto placement = affine_transform::translate(position)
+                           * affine_transform::rotate(vec3(0, 1, 0), random_double(0, 360))
+                           * affine_transform::scale(random_double(0.6, 1.2))
+                           * to_unit;
+            world.add(std::make_shared<instance>(teapot, placement, palette[random_int(0, 7)]));
+        }
+    }
+
+    auto ground_material = std::make_shared<lambertian>(colour(0.5, 0.5, 0.5));
+    world.add(std::make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
+
+    cam.aspect_ratio      = 16.0 / 9.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 16;
+    cam.max_depth         = 10;
+
+    cam.vfov     = 40;
+    cam.lookfrom = point3(-10,6,-10);
+    cam.lookat   = point3(20,0,20);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0.0;
+    cam.focus_dist    = 20.0;
+
+    return true;
+}
+
+// The built in scenes by name, for load_scene_objects and anything else that needs to
+// tell them apart from model files (such as the daemon's scene cache)
+struct builtin_scene {
+    const char* name;
+    bool (*load)(hittable_list& world, camera& cam, std::vector<hittable_list>* meshes);
+};
+
+inline const std::vector<builtin_scene>& builtin_scenes()
+{
+    static const std::vector<builtin_scene> scenes = {
+        {"final", [](hittable_list& world, camera& cam, std::vector<hittable_list>*) {
+            load_final_scene(world, cam);
+            return true;
+        }},
+        {"final_motion_blur", [](hittable_list& world, camera& cam, std::vector<hittable_list>*) {
+            load_final_scene_motion_blur(world, cam);
+            return true;
+        }},
+        {"many_lights", [](hittable_list& world, camera& cam, std::vector<hittable_list>* meshes) {
+            load_many_lights_scene(world, cam, meshes);
+            return true;
+        }},
+        {"teapots", [](hittable_list& world, camera& cam, std::vector<hittable_list>*) {
+            return load_teapots_scene(world, cam);
+        }},
+    };
+    return scenes;
+}
+
+inline const builtin_scene* find_builtin_scene(const std::string& name)
+{
+    for (const auto& scene : builtin_scenes())
+        if (name == scene.name)
+            return &scene;
+    return nullptr;
+}
+
+/* Loads the objects of a scene by name: one of builtin_scenes ("final", "final_motion_blur",
+   "many_lights" or "teapots"), otherwise name is taken as the path of a model file. The objects are
+   returned as a flat list, the emissive ones are collected into cam.lights and the
+   specular ones (caustic casters) into cam.caustics, and the materials are numbered from 1
+   (see material::id). If meshes is given, the scene's meshes (which are among objects
+   too) are added to it, one list each.
+   Returns false if the scene could not be loaded. */
+inline bool load_scene_objects(const std::string& name, hittable_list& objects, camera& cam,
+                               std::vector<hittable_list>* meshes = nullptr)
+{
+    material::restart_ids();
+    auto builtin = find_builtin_scene(name);
+    bool loaded = builtin ? builtin->load(objects, cam, meshes) : load_model_scene(name, objects, cam, meshes);
+
+    if (loaded) {
+        cam.lights = std::make_shared<light_tree>(objects);
+        cam.caustics = std::make_shared<photon_map>(objects);
+    }
+    return loaded;
+}
+
+// As load_scene_objects, but returns the world wrapped in a BVH ready for rendering
+inline bool load_scene(const std::string& name, hittable_list& world, camera& cam)
+{
+    if (!load_scene_objects(name, world, cam))
+        return false;
+    world = hittable_list(std::make_shared<bvh_node>(world));
+    return true;
+}
+
+#endif
@@ -0,0 +1,145 @@
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+
+#include "rtweekend.h"
+
+#include "animation.h"
+#include "camera.h"
+#include "framebuffer.h"
+#include "hittable_list.h"
+#include "lights.h"
+#include "photon_map.h"
+#include "reprojection.h"
+#include "tile.h"
+#include "tlas.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+/* Renders an animation one frame at a time.
+   The scene is a two level BVH (see tlas.h), so between frames the moving meshes only get
+   new instance transforms and the top level tree over the instances is refitted (or
+   rebuilt, once refits have made it too slow); the meshes' own BVHs are left alone. If the
+   moving meshes have emissive or specular triangles, the light tree and the photon map's
+   casters are made again for each frame, from still_surfaces and moved copies of those
+   triangles (in their pose halfway through the shutter interval).
+   The camera can fly along a keyframed path too. When only the camera moves, the samples
+   of each frame that are still valid in the next can be reused there (see reprojection.h),
+   so the next frame needs new samples mostly where it sees something new. */
+class sequence_renderer {
+    public:
+        int frames = 24;
+        double fps = 24; // Frame f is rendered at time f / fps
+        double shutter = 0; // Share of the frame interval the shutter is open for (moving meshes blur over it)
+        std::string output_pattern = "frame%04d.ppm"; // printf pattern taking the frame number
+        const camera_path* camera_motion = nullptr; // If set, the camera follows it
+        bool reuse_samples = false; // Reuse the last frame's samples (only if nothing in the scene moves)
+
+        /* Renders the frames of scene with the meshes (instances in it) moved to their pose
+           at each frame (and the camera to its own, with camera_motion). still_surfaces
+           are the objects of scene outside the moving meshes that can be lights or caustic
+           casters. Returns false if a frame could not be written. */
+        bool render(tlas& scene, const std::vector<animated_mesh>& meshes, const hittable_list& still_surfaces,
+                    camera& cam) {
+            using clock = std::chrono::steady_clock;
+            temporal_history history;
+            if (reuse_samples)
+                cam.aovs = true; // The history needs the depth and normals
+
+            for (int frame = 0; frame < frames; frame++) {
+                auto start = clock::now();
+                for (const auto& mesh : meshes) {
+                    if (!mesh.set_time(scene, frame / fps, shutter / fps)) {
+                        std::cerr << "ERROR::SEQUENCE:: An animated mesh is not in the scene" << std::endl;
+                        return false;
+                    }
+                }
+                if (camera_motion)
+                    camera_motion->apply(cam, frame / fps);
+                bool lights_moved = false;
+                for (const auto& mesh : meshes)
+                    lights_moved = lights_moved || mesh.has_surfaces();
+                if (lights_moved) {
+                    hittable_list surfaces = still_surfaces;
+                    for (const auto& mesh : meshes)
+                        mesh.posed_surfaces((frame + 0.5 * shutter) / fps, surfaces);
+                    // The new photon map is built by the frame's first render
+                    cam.lights = std::make_shared<light_tree>(surfaces);
+                    cam.caustics = std::make_shared<photon_map>(surfaces);
+                }
+                auto moved = clock::now();
+                auto update = scene.update();
+                auto built = clock::now();
+
+                framebuffer image;
+                auto spp = cam.samples_per_pixel;
+                size_t traced = 0, reused_pixels = 0;
+                if (reuse_samples && !history.empty()) {
+                    // A probe sample shows what each pixel sees now, the rest go where the
+                    // history can't be used. Frames take separate sample ranges, so the new
+                    // samples are not correlated with the ones they are averaged with.
+                    // Both passes are one render, sharing its set up and caches.
+                    auto base = frame * spp;
+                    auto tiles = cam.prepare(scene, image);
+                    run_tile_jobs(tiles.size(), cam.thread_count(), [&](size_t t) {
+                        cam.render_tile(scene, image, tiles[t], base, base + 1);
+                    }, cam.cancel, cam.show_progress);
+                    framebuffer reused;
+                    std::vector<uint32_t> counts;
+                    reused_pixels = history.reproject(cam, image, spp, reused, counts);
+                    image.merge(reused);
+                    // Pixel index takes samples [base + 1, base + 1 + counts[index])
+                    run_tile_jobs(tiles.size(), cam.thread_count(), [&](size_t t) {
+                        cam.render_tile(scene, image, tiles[t], base + 1, base + 1, &counts);
+                    }, cam.cancel, cam.show_progress);
+
+                    traced = image.sum.size();
+                    for (auto count : counts)
+                        traced += count;
+                } else {
+                    cam.render(scene, image, 0, spp);
+                    traced = image.sum.size() * spp;
+                }
+                if (reuse_samples)
+                    history.keep(image, cam);
+                auto rendered = clock::now();
+
+                char path[1024];
+                std::snprintf(path, sizeof(path), output_pattern.c_str(), frame);
+                std::ofstream file(path);
+                image.write_ppm(file);
+                if (!file) {
+                    std::cerr << "ERROR::SEQUENCE:: Could not write " << path << std::endl;
+                    return false;
+                }
+
+                std::cerr << "Frame " << frame << ": move " << milliseconds(start, moved) << "ms";
+                if (update != tlas::update_kind::none) {
+                    std::cerr << (update == tlas::update_kind::refit ? ", TLAS refit " : ", TLAS rebuild ")
+                              << milliseconds(moved, built) << "ms";
+                }
+                auto cost = scene.sah_cost();
+                std::cerr << ", SAH cost " << cost << " (" << cost / scene.built_sah_cost() << "x built)"
+                          << ", render " << milliseconds(built, rendered) << "ms";
+                if (reuse_samples) {
+                    auto pixels = static_cast<double>(image.sum.size());
+                    std::cerr << ", reused " << 100 * reused_pixels / pixels << "% of pixels, saved "
+                              << spp - traced / pixels << " spp";
+                }
+                std::cerr << std::endl;
+            }
+            return true;
+        }
+
+    private:
+        static double milliseconds(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+            return std::chrono::duration<double, std::milli>(to - from).count();
+        }
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Text settings, used for render daemon jobs and camera lists.
+   A line of settings is whitespace separated key=value pairs, e.g.
+     lookfrom=13,2,3 lookat=0,0,0 vfov=20 width=400 spp=64
+   Vectors are written as x,y,z (without spaces). */
+
+using setting = std::pair<std::string, std::string>;
+
+// Splits a line into its settings. Returns false if a token has no '='.
+inline bool parse_settings(const std::string& line, std::vector<setting>& settings) {
+    std::istringstream tokens(line);
+    std::string token;
+    while (tokens >> token) {
+        auto equals = token.find('=');
+        if (equals == std::string::npos || equals == 0)
+            return false;
+        settings.emplace_back(token.substr(0, equals), token.substr(equals + 1));
+    }
+    return true;
+}
+
+inline bool parse_double(const std::string& text, double& value) {
+    char* rest;
+    value = std::strtod(text.c_str(), &rest);
+    return !text.empty() && *rest == '\0';
+}
+
+inline bool parse_int(const std::string& text, int& value) {
+    char* rest;
+    value = static_cast<int>(std::strtol(text.c_str(), &rest, 10));
+    return !text.empty() && *rest == '\0';
+}
+
+inline bool parse_vec3(const std::string& text, vec3& v) {
+    std::istringstream parts(text);
+    std::string part;
+    for (int axis = 0; axis < 3; axis++) {
+        if (!std::getline(parts, part, ',') || !parse_double(part, v[axis]))
+            return false;
+    }
+    return !std::getline(parts, part, ',');
+}
+
+/* Applies one camera setting to cam. The keys are:
+     lookfrom, lookat, vup, vfov, width, aspect, spp, depth, defocus_angle, focus_dist
+   Returns false if key is not a camera setting or the value could not be parsed. */
+inline bool apply_camera_setting(camera& cam, const std::string& key, const std::string& value) {
+    if (key == "lookfrom")      return parse_vec3(value, cam.lookfrom);
+    if (key == "lookat")        return parse_vec3(value, cam.lookat);
+    if (key == "vup")           return parse_vec3(value, cam.vup);
+    if (key == "vfov")          return parse_double(value, cam.vfov);
+    if (key == "width")         return parse_int(value, cam.image_width) && cam.image_width > 0;
+    if (key == "aspect")        return parse_double(value, cam.aspect_ratio) && cam.aspect_ratio > 0;
+    if (key == "spp")           return parse_int(value, cam.samples_per_pixel) && cam.samples_per_pixel > 0;
+    if (key == "depth")         return parse_int(value, cam.max_depth);
+    if (key == "defocus_angle") return parse_double(value, cam.defocus_angle);
+    if (key == "focus_dist")    return parse_double(value, cam.focus_dist);
+    return false;
+}
+
+#endif
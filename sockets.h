@@ -0,0 +1,86 @@
+#ifndef SOCKETS_H
+#define SOCKETS_H
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* Small helpers for the Unix domain sockets used by the tile farm and the render daemon. */
+
+// Reads or writes exactly size bytes, returning false on error or a closed socket
+inline bool read_all(int fd, void* data, size_t size) {
+    auto bytes = static_cast<char*>(data);
+    while (size > 0) {
+        auto n = read(fd, bytes, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+inline bool write_all(int fd, const void* data, size_t size) {
+    auto bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        auto n = write(fd, bytes, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+inline sockaddr_un unix_address(const std::string& socket_path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+    return address;
+}
+
+// Returns a socket listening on socket_path (replacing any stale socket file), or -1
+inline int listen_unix(const std::string& socket_path) {
+    unlink(socket_path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    auto address = unix_address(socket_path);
+    if (fd < 0
+        || bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0
+        || listen(fd, 64) < 0) {
+        std::cerr << "ERROR::SOCKET:: Could not listen on " << socket_path << ": " << std::strerror(errno) << std::endl;
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Returns a socket connected to socket_path, or -1
+inline int connect_unix(const std::string& socket_path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    auto address = unix_address(socket_path);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        std::cerr << "ERROR::SOCKET:: Could not connect to " << socket_path << ": " << std::strerror(errno) << std::endl;
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Reads one '\n' terminated line (without the '\n'). Returns false if the socket closed first.
+inline bool read_line(int fd, std::string& line) {
+    line.clear();
+    char c;
+    while (read_all(fd, &c, 1)) {
+        if (c == '\n')
+            return true;
+        line += c;
+    }
+    return false;
+}
+
+#endif
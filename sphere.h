@@ -27,13 +27,33 @@ class sphere : public hittable {
         virtual bool hit(
             const ray& r, interval ray_t, hit_record& rec) const override;
 
+        bool occluded(const ray& r, interval ray_t) const override {
+            double root;
+            return intersect(r, ray_t, root);
+        }
+
         aabb bounding_box() const override { return bbox; }
 
+        const material* surface_material() const override { return mat.get(); }
+
+        double surface_area() const override { return 4*pi*radius*radius; }
+
+        bool sample_surface(const vec2& u, double time, point3& p, vec3& normal) const override {
+            auto z = 1 - 2*u[0];
+            auto r = sqrt(fmax(0.0, 1 - z*z));
+            auto phi = 2*pi*u[1];
+            normal = vec3(r*cos(phi), r*sin(phi), z);
+            p = centre.at(time) + radius*normal;
+            return true;
+        }
+
     private:
         ray centre;
         double radius;
         std::shared_ptr<material> mat;
         aabb bbox;
+
+        bool intersect(const ray& r, interval ray_bounds, double& root) const;
 };
 
 /* Solves the following quadratic equation: 
@@ -48,7 +68,7 @@ class sphere : public hittable {
    - One solution - the ray glances off the side of the sphere
    - Two solutions - the ray passes through the sphere (hitting a point on either side)
    */
-bool sphere::hit(const ray& r, interval ray_bounds, hit_record& rec) const {
+bool sphere::intersect(const ray& r, interval ray_bounds, double& root) const {
     point3 current_centre = centre.at(r.time());
     vec3 oc = r.origin() - current_centre;
     auto a = r.direction().length_squared();
@@ -60,19 +80,29 @@ bool sphere::hit(const ray& r, interval ray_bounds, hit_record& rec) const {
     auto sqrtd = sqrt(discriminant);
 
     // Find the nearest root that lies in the acceptable range.
-    auto root = (-half_b - sqrtd) / a;
+    root = (-half_b - sqrtd) / a;
     if (!ray_bounds.surrounds(root)) {
         root = (-half_b + sqrtd) / a;
             if (!ray_bounds.surrounds(root))
             return false;
     }
+    return true;
+}
 
+bool sphere::hit(const ray& r, interval ray_bounds, hit_record& rec) const {
+    double root;
+    if (!intersect(r, ray_bounds, root))
+        return false;
+
+    point3 current_centre = centre.at(r.time());
     rec.t = root; // Store value t in the hit record
     rec.p = r.at(rec.t); // Store the hit point
     vec3 outward_normal = (rec.p - current_centre) / radius; // Calculate unit normal (made unit by dividing by radius)
     rec.set_face_normal(r, outward_normal); // Determines if the ray is on the inside or outside of the sphere.
     //                                         Flips normal to face ray if on inside. 
     rec.mat = mat;
+    rec.object = this;
+    rec.instance = nullptr;
 
     return true;
 };
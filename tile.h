@@ -0,0 +1,66 @@
+#ifndef TILE_H
+#define TILE_H
+
+#include "progress.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+/* A rectangular block of pixels, [x0, x1) by [y0, y1).
+   Tiles are the unit of work handed out to render threads and worker processes. */
+struct tile {
+    int x0, y0;
+    int x1, y1;
+
+    int width() const { return x1 - x0; }
+    int height() const { return y1 - y0; }
+    int pixel_count() const { return width() * height(); }
+};
+
+// Splits an image into tiles of (at most) tile_size x tile_size pixels, in scanline order
+inline std::vector<tile> make_tiles(int image_width, int image_height, int tile_size) {
+    std::vector<tile> tiles;
+    for (int y = 0; y < image_height; y += tile_size) {
+        for (int x = 0; x < image_width; x += tile_size) {
+            tiles.push_back(tile{x, y, std::min(x + tile_size, image_width), std::min(y + tile_size, image_height)});
+        }
+    }
+    return tiles;
+}
+
+/* Runs render_job(0) ... render_job(job_count - 1) on thread_count threads (the calling
+   thread is one of them). Jobs are handed out in order to whichever thread is free next,
+   so one slow job does not hold the other threads up. If cancel is given, no more jobs
+   are started once it becomes true. Progress is reported by a progress_reporter. */
+template <typename job_function>
+void run_tile_jobs(size_t job_count, int thread_count, job_function render_job,
+                   const std::atomic<bool>* cancel = nullptr, bool show_progress = true) {
+    std::atomic<size_t> next_job{0};
+    progress_reporter progress(job_count, thread_count, show_progress);
+    progress.start();
+
+    auto render_worker = [&](int slot) {
+        progress.begin_worker(slot);
+        for (size_t job = next_job++; job < job_count; job = next_job++) {
+            if (cancel && cancel->load(std::memory_order_relaxed))
+                return;
+            auto job_start = std::chrono::steady_clock::now();
+            render_job(job);
+            progress.tile_done(slot, std::chrono::steady_clock::now() - job_start);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int t = 1; t < thread_count; t++)
+        pool.emplace_back(render_worker, t);
+    render_worker(0);
+    for (auto& thread : pool)
+        thread.join();
+
+    progress.stop();
+}
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef TLAS_H
+#define TLAS_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "transform.h"
+
+#include <memory>
+#include <vector>
+
+/* Two level acceleration structure: a top level BVH (the TLAS) over instances of objects
+   that each have their own bottom level BVH (a BLAS, see instance.h), one per mesh or
+   object.
+   A single BVH over every primitive has to be refitted or rebuilt as a whole when anything
+   in it moves. Here moving an object only changes its instance's transform: its BLAS stays
+   as it is, and only the top level tree, with one box per instance, is refitted. Refits make
+   the tree worse as instances move away from where they were at the last build, so it is
+   rebuilt once its SAH cost has grown by more than rebuild_threshold over the cost straight
+   after that build. An edit so costs the work on what changed (a new BLAS only for an edited
+   mesh) plus a pass over the instance boxes, whatever the number of triangles.
+
+   Edits take effect at the next update(), which must come before rendering, and neither
+   may happen during a render. Instance ids stay valid until they are removed. */
+class tlas : public hittable {
+    public:
+        enum class update_kind {none, refit, rebuild};
+
+        double rebuild_threshold = 1.3; // Rebuild once the SAH cost grows by this factor
+
+        // Adds an instance of object (a BLAS or a single primitive) and returns its id
+        size_t add(std::shared_ptr<const hittable> object, const affine_transform& to_world = affine_transform(),
+                   std::shared_ptr<material> mat = nullptr) {
+            instances.push_back(std::make_shared<instance>(std::move(object), to_world, std::move(mat)));
+            structure_changed = true;
+            return instances.size() - 1;
+        }
+
+        /* Edits return false (and change nothing) if id was never added or has been
+           removed. */
+        bool remove(size_t id) {
+            if (!valid(id))
+                return false;
+            instances[id] = nullptr;
+            structure_changed = true;
+            return true;
+        }
+
+        bool set_transform(size_t id, const affine_transform& to_world) {
+            if (!valid(id))
+                return false;
+            instances[id]->set_transform(to_world);
+            moved = true;
+            return true;
+        }
+
+        // Moves the instance from start to end over the shutter interval (motion blur)
+        bool set_transform(size_t id, const affine_transform& start, const affine_transform& end) {
+            if (!valid(id))
+                return false;
+            instances[id]->set_transform(start, end);
+            moved = true;
+            return true;
+        }
+
+        // Swaps in another object for an instance, e.g. a new BLAS for an edited mesh
+        bool set_object(size_t id, std::shared_ptr<const hittable> object) {
+            if (!valid(id))
+                return false;
+            instances[id]->set_object(std::move(object));
+            moved = true;
+            return true;
+        }
+
+        bool valid(size_t id) const { return id < instances.size() && instances[id]; }
+
+        // Instances, counting removed ones (as their ids are not reused)
+        size_t size() const { return instances.size(); }
+
+        // Brings the top level tree up to date with the edits since the last update
+        update_kind update() {
+            if (structure_changed) {
+                rebuild();
+                return update_kind::rebuild;
+            }
+            if (!moved)
+                return update_kind::none;
+
+            moved = false;
+            top->refit();
+            if (top->sah_cost() > rebuild_threshold * built_cost) {
+                rebuild();
+                return update_kind::rebuild;
+            }
+            return update_kind::refit;
+        }
+
+        double sah_cost() const { return top ? top->sah_cost() : 0; }
+        double built_sah_cost() const { return built_cost; } // Straight after the last rebuild
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            return top && top->hit(r, ray_t, rec);
+        }
+
+        bool occluded(const ray& r, interval ray_t) const override {
+            return top && top->occluded(r, ray_t);
+        }
+
+        aabb bounding_box() const override { return top ? top->bounding_box() : aabb::empty; }
+
+    private:
+        std::vector<std::shared_ptr<instance>> instances; // By id, null once removed
+        std::shared_ptr<bvh_node> top;
+        double built_cost = 0;
+        bool structure_changed = false; // Instances added or removed
+        bool moved = false; // Instances moved or given other objects
+
+        void rebuild() {
+            hittable_list live;
+            for (const auto& object : instances)
+                if (object)
+                    live.add(object);
+            top = live.objects.empty() ? nullptr : std::make_shared<bvh_node>(live);
+            built_cost = sah_cost();
+            structure_changed = moved = false;
+        }
+};
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+
+/* Affine transform (a 3x4 matrix: linear part plus translation), kept together with its
+   inverse since placing objects needs both ways: rays go into object space through the
+   inverse, hit points and normals come back through the transform (normals through the
+   transpose of the inverse, which keeps them perpendicular under non-uniform scaling). */
+class affine_transform {
+    public:
+        affine_transform() {
+            for (int r = 0; r < 3; r++)
+                for (int c = 0; c < 4; c++)
+                    m[r][c] = inv[r][c] = r == c ? 1 : 0;
+        }
+
+        static affine_transform translate(const vec3& offset) {
+            affine_transform t;
+            for (int r = 0; r < 3; r++) {
+                t.m[r][3] = offset[r];
+                t.inv[r][3] = -offset[r];
+            }
+            return t;
+        }
+
+        static affine_transform scale(const vec3& factors) {
+            affine_transform t;
+            for (int r = 0; r < 3; r++) {
+                t.m[r][r] = factors[r];
+                t.inv[r][r] = 1 / factors[r];
+            }
+            return t;
+        }
+
+        static affine_transform scale(double factor) { return scale(vec3(factor, factor, factor)); }
+
+        // Rotation by degrees around axis (right handed: counterclockwise looking down the axis)
+        static affine_transform rotate(const vec3& axis, double degrees) {
+            auto a = unit_vector(axis);
+            auto theta = degrees_to_radians(degrees);
+            auto s = sin(theta), c = cos(theta);
+            affine_transform t;
+            for (int r = 0; r < 3; r++) {
+                for (int k = 0; k < 3; k++) {
+                    // Rodrigues: c I + (1 - c) a a^T + s [a]x
+                    auto cross_term = 0.0;
+                    if (r != k) {
+                        int other = 3 - r - k;
+                        auto sign = (k == (r + 1) % 3) ? -1 : 1;
+                        cross_term = sign * a[other];
+                    }
+                    t.m[r][k] = (r == k ? c : 0) + (1 - c) * a[r] * a[k] + s * cross_term;
+                }
+            }
+            // A rotation's inverse is its transpose
+            for (int r = 0; r < 3; r++)
+                for (int k = 0; k < 3; k++)
+                    t.inv[r][k] = t.m[k][r];
+            return t;
+        }
+
+        // This transform applied after other
+        affine_transform operator*(const affine_transform& other) const {
+            affine_transform t;
+            multiply(m, other.m, t.m);
+            multiply(other.inv, inv, t.inv);
+            return t;
+        }
+
+        /* The transform a fraction t of the way from a to b, interpolating the matrices. A
+           point then moves in a straight line from where a puts it to where b does, so the
+           boxes of an object under a and b bound it at every t in between. Rotations shrink
+           a little halfway (the matrices are not decomposed), so a and b should be close,
+           as they are over a shutter interval. */
+        static affine_transform interpolate(const affine_transform& a, const affine_transform& b, double t) {
+            affine_transform result;
+            for (int r = 0; r < 3; r++)
+                for (int c = 0; c < 4; c++)
+                    result.m[r][c] = (1-t)*a.m[r][c] + t*b.m[r][c];
+            result.invert();
+            return result;
+        }
+
+        affine_transform inverse() const {
+            affine_transform t;
+            for (int r = 0; r < 3; r++)
+                for (int c = 0; c < 4; c++) {
+                    t.m[r][c] = inv[r][c];
+                    t.inv[r][c] = m[r][c];
+                }
+            return t;
+        }
+
+        bool is_identity() const {
+            for (int r = 0; r < 3; r++)
+                for (int c = 0; c < 4; c++)
+                    if (m[r][c] != (r == c ? 1 : 0))
+                        return false;
+            return true;
+        }
+
+        point3 point(const point3& p) const { return apply(m, p) + translation(m); }
+        vec3 vector(const vec3& v) const { return apply(m, v); }
+        point3 inverse_point(const point3& p) const { return apply(inv, p) + translation(inv); }
+        vec3 inverse_vector(const vec3& v) const { return apply(inv, v); }
+
+        // Maps a normal: by the transpose of the inverse (not normalised)
+        vec3 normal(const vec3& n) const {
+            return vec3(inv[0][0]*n[0] + inv[1][0]*n[1] + inv[2][0]*n[2],
+                        inv[0][1]*n[0] + inv[1][1]*n[1] + inv[2][1]*n[2],
+                        inv[0][2]*n[0] + inv[1][2]*n[1] + inv[2][2]*n[2]);
+        }
+
+        // Box around the transformed corners of box
+        aabb box(const aabb& b) const {
+            aabb result = aabb::empty;
+            for (int corner = 0; corner < 8; corner++) {
+                point3 p((corner & 1) ? b.x.max : b.x.min, (corner & 2) ? b.y.max : b.y.min,
+                         (corner & 4) ? b.z.max : b.z.min);
+                auto q = point(p);
+                result = aabb(result, aabb(q, q));
+            }
+            return result;
+        }
+
+    private:
+        double m[3][4]; // Object to world
+        double inv[3][4]; // World to object
+
+        static vec3 apply(const double a[3][4], const vec3& v) {
+            return vec3(a[0][0]*v[0] + a[0][1]*v[1] + a[0][2]*v[2],
+                        a[1][0]*v[0] + a[1][1]*v[1] + a[1][2]*v[2],
+                        a[2][0]*v[0] + a[2][1]*v[1] + a[2][2]*v[2]);
+        }
+        static vec3 translation(const double a[3][4]) { return vec3(a[0][3], a[1][3], a[2][3]); }
+
+        // Works out inv from m: the inverse of the linear part by cofactors, then the translation
+        void invert() {
+            auto cofactor = [&](int r, int c) {
+                int r0 = (r + 1) % 3, r1 = (r + 2) % 3, c0 = (c + 1) % 3, c1 = (c + 2) % 3;
+                return m[r0][c0]*m[r1][c1] - m[r0][c1]*m[r1][c0];
+            };
+            auto det = m[0][0]*cofactor(0, 0) + m[0][1]*cofactor(0, 1) + m[0][2]*cofactor(0, 2);
+            for (int r = 0; r < 3; r++)
+                for (int c = 0; c < 3; c++)
+                    inv[r][c] = cofactor(c, r) / det;
+            for (int r = 0; r < 3; r++)
+                inv[r][3] = -(inv[r][0]*m[0][3] + inv[r][1]*m[1][3] + inv[r][2]*m[2][3]);
+        }
+
+        // out = a b, as 4x4 matrices with the implied last row 0 0 0 1
+        static void multiply(const double a[3][4], const double b[3][4], double out[3][4]) {
+            for (int r = 0; r < 3; r++) {
+                for (int c = 0; c < 4; c++) {
+                    out[r][c] = a[r][0]*b[0][c] + a[r][1]*b[1][c] + a[r][2]*b[2][c] + (c == 3 ? a[r][3] : 0);
+                }
+            }
+        }
+};
+
+#endif
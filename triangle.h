@@ -11,16 +11,9 @@
 class triangle : public hittable {
     public:
         triangle(point3 v0, point3 v1, point3 v2, std::shared_ptr<material> material, vec3 direction)
-         : v{v0, v1, v2}, mat{material}, direction{direction}
+         : mat{material}, direction{direction}
         {
-            vec3 v0v1 = v1 - v0;
-            vec3 v0v2 = v2 - v0;
-            normal = cross(v0v1, v0v2);
-            D = -dot(normal, v0);
-            
-            bbox = aabb(interval(v0.x(), v1.x(), v2.x()), 
-                        interval(v0.y(), v1.y(), v2.y()), 
-                        interval(v0.z(), v1.z(), v2.z()));
+            set_vertices(v0, v1, v2);
         }
 
         triangle(point3 v0, point3 v1, point3 v2, std::shared_ptr<material> material)
@@ -29,8 +22,46 @@ class triangle : public hittable {
         virtual bool hit(
             const ray& r, interval ray_t, hit_record& rec) const override;
 
+        bool occluded(const ray& r, interval ray_t) const override {
+            double t, bu, bv;
+            return intersect_moller_trumbore(r, ray_t, t, bu, bv);
+        }
+
         aabb bounding_box() const override { return bbox; }
 
+        point3 vertex(int i) const { return v[i]; }
+
+        const material* surface_material() const override { return mat.get(); }
+
+        double surface_area() const override { return 0.5 * normal.length(); }
+
+        bool sample_surface(const vec2& u, double time, point3& p, vec3& n) const override {
+            // Uniform barycentric coordinates (the square root keeps the density even)
+            auto su = sqrt(u[0]);
+            auto b0 = 1 - su;
+            auto b1 = u[1] * su;
+            p = b0*v[0] + b1*v[1] + (1 - b0 - b1)*v[2] + time*direction;
+            n = unit_vector(normal);
+            return true;
+        }
+
+        // Moves the triangle (to edit a mesh in place). Any BVH containing it needs refitting.
+        void set_vertices(point3 v0, point3 v1, point3 v2) {
+            v[0] = v0;
+            v[1] = v1;
+            v[2] = v2;
+
+            vec3 v0v1 = v1 - v0;
+            vec3 v0v2 = v2 - v0;
+            normal = cross(v0v1, v0v2);
+            D = -dot(normal, v0);
+            
+            bbox = aabb(interval(v0.x(), v1.x(), v2.x()), 
+                        interval(v0.y(), v1.y(), v2.y()), 
+                        interval(v0.z(), v1.z(), v2.z()));
+            bbox.pad_to_minimums();
+        }
+
     private:
         point3 v[3];
         vec3 normal;
@@ -42,6 +73,7 @@ class triangle : public hittable {
         bool hit_geometric(const ray& r, interval ray_bounds, hit_record& rec) const;
         bool hit_geometric_smooth(const ray& r, interval ray_bounds, hit_record& rec) const;
         bool hit_moller_trumbore(const ray& r, interval ray_bounds, hit_record& rec) const;
+        bool intersect_moller_trumbore(const ray& r, interval ray_bounds, double& t, double& bu, double& bv) const;
 };
 
 
@@ -98,6 +130,8 @@ bool triangle::hit_geometric(const ray& r, interval ray_bounds, hit_record& rec)
     rec.set_face_normal(r, unit_vector(normal));
     rec.mat = mat;
     rec.uv = vec2(u, v);
+    rec.object = this;
+    rec.instance = nullptr;
     
     return true;
 }
@@ -122,6 +156,23 @@ bool triangle::hit_geometric(const ray& r, interval ray_bounds, hit_record& rec)
    - If det(M) < 0 ray is backfacing
 */
 bool triangle::hit_moller_trumbore(const ray& r, interval ray_bounds, hit_record& rec) const {
+    double t, u, v;
+    if (!intersect_moller_trumbore(r, ray_bounds, t, u, v))
+        return false;
+
+    rec.t = t;
+    rec.p = r.at(t);
+    rec.set_face_normal(r, unit_vector(normal));
+    rec.mat = mat;
+    rec.uv = vec2(u, v);
+    rec.object = this;
+    rec.instance = nullptr;
+    
+    return true;
+}
+
+// Ray parameter t and barycentric bu, bv of the hit, if r hits the triangle in ray_bounds
+bool triangle::intersect_moller_trumbore(const ray& r, interval ray_bounds, double& t, double& bu, double& bv) const {
     point3 v0 = v[0] + r.time()*direction;
     point3 v1 = v[1] + r.time()*direction;
     point3 v2 = v[2] + r.time()*direction;
@@ -142,23 +193,22 @@ bool triangle::hit_moller_trumbore(const ray& r, interval ray_bounds, hit_record
     double v = dot(txe1, r.dir) * invDet;
     if (v < 0 || u + v > 1) return false;
 
-    double t = dot(txe1, e2) * invDet;
+    t = dot(txe1, e2) * invDet;
+    bu = u;
+    bv = v;
 
-    if (t < 0 || !ray_bounds.surrounds(t)) return false;
-
-    rec.t = t;
-    rec.p = r.at(t);
-    rec.set_face_normal(r, unit_vector(normal));
-    rec.mat = mat;
-    rec.uv = vec2(u, v);
-    
-    return true;
+    return t >= 0 && ray_bounds.surrounds(t);
 }
 
 
-void mesh_to_hittables(Model &model, hittable_list &hittables, std::shared_ptr<material> mat, vec3 direction) {
+// Adds the triangles of every mesh in model to hittables, and if meshes is given, each
+// mesh's triangles to a list of their own there as well
+void mesh_to_hittables(Model &model, hittable_list &hittables, std::shared_ptr<material> mat, vec3 direction,
+                       std::vector<hittable_list>* meshes = nullptr) {
     std::cerr << "Num meshes:" << model.meshes.size() << std::endl;
     for (int m = 0; m < model.meshes.size(); m++) {
+        if (meshes)
+            meshes->emplace_back();
         Mesh mesh = model.meshes[m];
         int acc = 0;
         for (int i = 0; i < mesh.indices.size(); i += 3) {
@@ -167,6 +217,8 @@ void mesh_to_hittables(Model &model, hittable_list &hittables, std::shared_ptr<m
             point3 v2 = mesh.vertices[mesh.indices[i+2]].Position;
             std::shared_ptr<triangle> tri = std::make_shared<triangle>(triangle{v0, v1, v2, mat, direction});
             hittables.add(tri);
+            if (meshes)
+                meshes->back().add(tri);
             acc += 1;
         }
         std::cerr << "Num triangles in mesh: " << acc << std::endl;